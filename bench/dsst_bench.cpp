@@ -0,0 +1,366 @@
+/*
+Headless benchmark over OTB sequences: dsst_bench [-c config.json] [-gray] [-half] [-reuse] <sequence>...
+
+A sequence is a directory with groundtruth_rect.txt and img/ (e.g. Bird1/). All of its frames
+are decoded into memory before the tracker runs, so only init() and update() are timed, with a
+monotonic clock. For every sequence and for all of them together it prints the latency
+percentiles and FPS of the two stages and the OTB success and precision scores:
+    success AUC:      mean over the overlap thresholds 0, 0.05, ..., 1 of the fraction of frames above them
+    precision AUC:    the same for the center error thresholds 0, 1, ..., 50 px
+    precision @20px:  fraction of frames with a center error of at most 20 px
+The tracker parameters are read from the config file (default ../src/config.json) like runtracker.
+-half and -reuse run every sequence once more with a parameter switched on ("half storage",
+"scale reuse sample"), after a run with it off, and print the differences of the two AUCs.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "kcftracker.hpp"
+#include "json/json.h"
+
+#define CONFIG_FILENAME "../src/config.json"
+
+struct Sequence
+{
+    std::string name;
+    std::vector<cv::Mat> frames;
+    std::vector<cv::Rect_<float> > groundtruth;
+};
+
+struct Result
+{
+    std::vector<double> init_ms;    // latency of init(), one per sequence
+    std::vector<double> update_ms;  // latency of update(), one per frame after the first
+    std::vector<float> overlap;     // IoU with the groundtruth, frames with a valid groundtruth only
+    std::vector<float> center_error;
+    std::vector<double> cost;       // estimateCost().total before every update()
+    int scale_searches;             // updates that ran the scale search
+    int trainings;                  // updates that trained the translation model
+
+    Result() : scale_searches(0), trainings(0) {}
+
+    void append(const Result &other)
+    {
+        scale_searches += other.scale_searches;
+        trainings += other.trainings;
+        init_ms.insert(init_ms.end(), other.init_ms.begin(), other.init_ms.end());
+        update_ms.insert(update_ms.end(), other.update_ms.begin(), other.update_ms.end());
+        overlap.insert(overlap.end(), other.overlap.begin(), other.overlap.end());
+        center_error.insert(center_error.end(), other.center_error.begin(), other.center_error.end());
+        cost.insert(cost.end(), other.cost.begin(), other.cost.end());
+    }
+};
+
+// Boxes separated by commas, tabs or spaces, one per line
+static bool loadGroundtruth(const std::string &path, std::vector<cv::Rect_<float> > &boxes)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::replace(line.begin(), line.end(), '\t', ' ');
+        std::istringstream ss(line);
+        cv::Rect_<float> box;
+        if (ss >> box.x >> box.y >> box.width >> box.height)
+            boxes.push_back(box);
+    }
+    return !boxes.empty();
+}
+
+// The images of dir in name order
+static std::vector<std::string> listImages(const std::string &dir)
+{
+    std::vector<std::string> names;
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return names;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        std::string name = entry->d_name;
+        size_t dot = name.rfind('.');
+        if (dot == std::string::npos)
+            continue;
+        std::string ext = name.substr(dot + 1);
+        if (ext == "jpg" || ext == "png" || ext == "bmp")
+            names.push_back(name);
+    }
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static bool loadSequence(std::string path, int flags, Sequence &seq)
+{
+    if (!path.empty() && path[path.size() - 1] != '/')
+        path += '/';
+    seq.name = path;
+
+    if (!loadGroundtruth(path + "groundtruth_rect.txt", seq.groundtruth)) {
+        printf("%s: no groundtruth_rect.txt\n", path.c_str());
+        return false;
+    }
+
+    std::vector<std::string> names = listImages(path + "img");
+    size_t n = std::min(names.size(), seq.groundtruth.size());
+    for (size_t i = 0; i < n; i++) {
+        cv::Mat image = cv::imread(path + "img/" + names[i], flags);
+        if (image.empty()) {
+            printf("%s: failed to read %s\n", path.c_str(), names[i].c_str());
+            return false;
+        }
+        seq.frames.push_back(image);
+    }
+
+    if (seq.frames.empty()) {
+        printf("%s: no images in img/\n", path.c_str());
+        return false;
+    }
+    seq.groundtruth.resize(seq.frames.size());
+    return true;
+}
+
+static KCFTracker *createTracker(const Json::Value &root)
+{
+    KCFTracker *tracker = new KCFTracker(root.get("hog", 1).asInt(), root.get("fixed window", 0).asInt(),
+                                         root.get("multi scale", 1).asInt(), root.get("lab", 0).asInt());
+    tracker->scale_step = root.get("scale step", tracker->scale_step).asFloat();
+    tracker->n_scales = root.get("num scales", tracker->n_scales).asInt();
+    tracker->fast_scale = root.get("fast scale", tracker->fast_scale).asInt();
+    tracker->n_interp_scales = root.get("num interp scales", tracker->n_interp_scales).asInt();
+    tracker->scale_threads = root.get("scale threads", tracker->scale_threads).asInt();
+    tracker->scale_reuse_sample = root.get("scale reuse sample", tracker->scale_reuse_sample).asInt();
+    tracker->pyramid_levels = root.get("pyramid levels", tracker->pyramid_levels).asInt();
+    tracker->adaptive = root.get("adaptive", tracker->adaptive).asInt();
+    tracker->adaptive_stable_psr = root.get("adaptive stable psr", tracker->adaptive_stable_psr).asFloat();
+    tracker->adaptive_scale_interval = root.get("adaptive scale interval", tracker->adaptive_scale_interval).asInt();
+    tracker->adaptive_min_psr = root.get("adaptive min psr", tracker->adaptive_min_psr).asFloat();
+    tracker->half_storage = root.get("half storage", tracker->half_storage).asInt();
+    tracker->bounded_cost = root.get("bounded cost", tracker->bounded_cost).asInt();
+    tracker->max_window_pixels = root.get("max window pixels", tracker->max_window_pixels).asInt();
+    tracker->diagnostics = root.get("diagnostics", tracker->diagnostics).asInt();
+    return tracker;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void score(const cv::Rect_<float> &box, const cv::Rect_<float> &gt, Result &result)
+{
+    // OTB marks frames without a target with an empty or NaN box
+    if (!(gt.width > 0 && gt.height > 0))
+        return;
+
+    float inter = (box & gt).area();
+    float uni = box.area() + gt.area() - inter;
+    result.overlap.push_back(uni > 0 ? inter / uni : 0.f);
+
+    float dx = (box.x + box.width / 2) - (gt.x + gt.width / 2);
+    float dy = (box.y + box.height / 2) - (gt.y + gt.height / 2);
+    result.center_error.push_back(std::sqrt(dx * dx + dy * dy));
+}
+
+static Result run(const Sequence &seq, const Json::Value &config)
+{
+    Result result;
+    KCFTracker *tracker = createTracker(config);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    tracker->init(cv::Rect(seq.groundtruth[0]), seq.frames[0]);
+    result.init_ms.push_back(elapsedMs(start));
+
+    for (size_t i = 1; i < seq.frames.size(); i++) {
+        result.cost.push_back(tracker->estimateCost().total);
+        start = std::chrono::steady_clock::now();
+        cv::Rect box = tracker->update(seq.frames[i]);
+        result.update_ms.push_back(elapsedMs(start));
+        result.scale_searches += tracker->stages().scale_detected;
+        result.trainings += tracker->stages().trained;
+        score(box, seq.groundtruth[i], result);
+    }
+
+    if (tracker->fhog_mismatches() > 0)
+        printf("%d patches with FHOG mismatches\n", tracker->fhog_mismatches());
+
+    // Built with KCF_PROFILE, the split of the time over the stages
+    if (TrackerProfile::enabled())
+        printf("%s\n", tracker->profile().toJsonString().c_str());
+
+    delete tracker;
+    return result;
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t) std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+
+static void printStage(const char *stage, std::vector<double> ms)
+{
+    if (ms.empty())
+        return;
+    std::sort(ms.begin(), ms.end());
+    double total = 0;
+    for (size_t i = 0; i < ms.size(); i++)
+        total += ms[i];
+    printf("  %-6s n=%-6d p50=%8.3f ms  p95=%8.3f ms  p99=%8.3f ms  fps=%8.1f\n", stage, (int) ms.size(),
+           percentile(ms, 50), percentile(ms, 95), percentile(ms, 99), ms.size() * 1000.0 / total);
+}
+
+// Mean over the thresholds 0, step, ..., (count - 1) * step of the fraction of values on the good side of them
+static double auc(const std::vector<float> &values, float step, int count, bool above)
+{
+    if (values.empty())
+        return 0;
+    double sum = 0;
+    for (int k = 0; k < count; k++) {
+        float t = k * step;
+        int good = 0;
+        for (size_t i = 0; i < values.size(); i++)
+            good += above ? values[i] > t : values[i] <= t;
+        sum += good / (double) values.size();
+    }
+    return sum / count;
+}
+
+static void printResult(const std::string &name, const Result &result)
+{
+    printf("%s\n", name.c_str());
+    printStage("init", result.init_ms);
+    printStage("update", result.update_ms);
+
+    int within20 = 0;
+    for (size_t i = 0; i < result.center_error.size(); i++)
+        within20 += result.center_error[i] <= 20;
+    printf("  success AUC %.4f  precision AUC %.4f  precision @20px %.4f\n",
+           auc(result.overlap, 0.05f, 21, true), auc(result.center_error, 1.f, 51, false),
+           result.center_error.empty() ? 0.0 : within20 / (double) result.center_error.size());
+    if (!result.cost.empty()) {
+        std::vector<double> cost = result.cost;
+        std::sort(cost.begin(), cost.end());
+        printf("  estimated cost p50 %.0f  max %.0f\n", percentile(cost, 50), cost.back());
+    }
+    if (!result.update_ms.empty())
+        printf("  scale search %.1f%%  training %.1f%% of the updates\n",
+               100.0 * result.scale_searches / result.update_ms.size(), 100.0 * result.trainings / result.update_ms.size());
+}
+
+// A parameter whose effect on the accuracy is measured, by tracking with it off and on
+struct Comparison
+{
+    const char *flag;  // command line option
+    const char *key;   // parameter in the config
+    const char *label; // of the runs with the parameter on
+    const char *difference;
+    Result all;
+};
+
+// Accuracy of the runs with a parameter on relative to the ones with it off
+static void printDifference(const Comparison &comparison, const Result &reference, const Result &result)
+{
+    printf("  %s: success AUC %+.4f  precision AUC %+.4f\n", comparison.difference,
+           auc(result.overlap, 0.05f, 21, true) - auc(reference.overlap, 0.05f, 21, true),
+           auc(result.center_error, 1.f, 51, false) - auc(reference.center_error, 1.f, 51, false));
+}
+
+int main(int argc, char *argv[])
+{
+    std::string configPath = CONFIG_FILENAME;
+    int flags = cv::IMREAD_COLOR;
+    Comparison comparisons[] = {
+        {"-half", "half storage", "half storage", "half - float", Result()},
+        {"-reuse", "scale reuse sample", "scale reuse sample", "reuse - recompute", Result()},
+    };
+    const int n_comparisons = sizeof(comparisons) / sizeof(comparisons[0]);
+    std::vector<Comparison *> compared;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        int c = 0;
+        while (c < n_comparisons && strcmp(argv[i], comparisons[c].flag) != 0)
+            c++;
+        if (c < n_comparisons) {
+            if (std::find(compared.begin(), compared.end(), &comparisons[c]) == compared.end())
+                compared.push_back(&comparisons[c]);
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            configPath = argv[++i];
+        else if (strcmp(argv[i], "-gray") == 0)
+            flags = cv::IMREAD_GRAYSCALE;
+        else
+            paths.push_back(argv[i]);
+    }
+
+    if (paths.empty()) {
+        printf("usage: %s [-c config.json] [-gray] [-half] [-reuse] <sequence>...\n", argv[0]);
+        printf("  -half:  also track with half precision models and compare to the float ones\n");
+        printf("  -reuse: also track reusing the scale sample and compare to recomputing it\n");
+        return -1;
+    }
+
+    Json::Value config;
+    std::ifstream configFile(configPath.c_str());
+    Json::Reader reader;
+    if (!configFile || !reader.parse(configFile, config)) {
+        printf("failed to read %s, using the default parameters\n", configPath.c_str());
+        config = Json::Value(Json::objectValue);
+    }
+
+    // The reference runs have all the compared parameters off, each comparison switches on one of them
+    for (size_t c = 0; c < compared.size(); c++)
+        config[compared[c]->key] = 0;
+
+    Result all;
+    int sequences = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        Sequence seq;
+        if (!loadSequence(paths[i], flags, seq))
+            continue;
+
+        Result result = run(seq, config);
+        printResult(seq.name, result);
+        all.append(result);
+        sequences++;
+
+        for (size_t c = 0; c < compared.size(); c++) {
+            Json::Value on = config;
+            on[compared[c]->key] = 1;
+            Result other = run(seq, on);
+            printResult(seq.name + " (" + compared[c]->label + ")", other);
+            printDifference(*compared[c], result, other);
+            compared[c]->all.append(other);
+        }
+    }
+
+    if (sequences > 1) {
+        printResult("all sequences", all);
+        for (size_t c = 0; c < compared.size(); c++) {
+            printResult(std::string("all sequences (") + compared[c]->label + ")", compared[c]->all);
+            printDifference(*compared[c], all, compared[c]->all);
+        }
+    }
+    return sequences > 0 ? 0 : -1;
+}
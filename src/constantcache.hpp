@@ -0,0 +1,106 @@
+/*
+Process-wide cache of immutable values, computed once per key.
+
+The trackers keep the constant tensors of their configuration here (cosine windows, gaussian
+target spectra, scale factors), so that starting a tracker for a new target of a known size is
+a lookup. A value is never changed once it is in the cache: it is only read, from any thread,
+and kept alive by the shared pointers of its users.
+
+The cache itself only holds on to the Recent values looked up last. The others stay cached while
+some tracker uses them, and are dropped once the last one lets go, so a long-running process that
+sees many target sizes keeps just the values in use and the recent ones.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+
+template <typename Key, typename Value, size_t Recent = 8>
+class ConstantCache
+{
+public:
+    typedef std::shared_ptr<const Value> Pointer;
+
+    // The value of key, computed with compute(Value &) on the first lookup, or once it was dropped.
+    // When two threads miss at once both compute it, and both get the value that was inserted first.
+    template <typename Compute>
+    Pointer get(const Key &key, Compute compute)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Pointer cached = find(key);
+            if (cached)
+                return cached;
+        }
+
+        std::shared_ptr<Value> value(new Value());
+        compute(*value);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        Pointer cached = find(key);
+        if (cached)
+            return cached;
+
+        // Forget the dropped values before adding one
+        for (typename std::map<Key, Entry>::iterator it = _values.begin(); it != _values.end();) {
+            if (it->second.expired())
+                _values.erase(it++);
+            else
+                ++it;
+        }
+        Pointer inserted(value);
+        _values[key] = inserted;
+        touch(inserted);
+        return inserted;
+    }
+
+    // Number of values still cached
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t n = 0;
+        for (typename std::map<Key, Entry>::const_iterator it = _values.begin(); it != _values.end(); ++it)
+            n += !it->second.expired();
+        return n;
+    }
+
+    // Forget all values, the ones still in use stay valid
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _values.clear();
+        _recent.clear();
+    }
+
+private:
+    typedef std::weak_ptr<const Value> Entry;
+
+    // The live value of key, or null. The caller holds the lock.
+    Pointer find(const Key &key)
+    {
+        typename std::map<Key, Entry>::const_iterator it = _values.find(key);
+        Pointer value = it != _values.end() ? it->second.lock() : Pointer();
+        if (value)
+            touch(value);
+        return value;
+    }
+
+    // Make value the most recent one, keeping at most Recent of them alive
+    void touch(const Pointer &value)
+    {
+        typename std::deque<Pointer>::iterator it = std::find(_recent.begin(), _recent.end(), value);
+        if (it != _recent.end())
+            _recent.erase(it);
+        _recent.push_front(value);
+        if (_recent.size() > Recent)
+            _recent.pop_back();
+    }
+
+    mutable std::mutex _mutex;
+    std::map<Key, Entry> _values;
+    std::deque<Pointer> _recent;
+};
@@ -0,0 +1,47 @@
+/*
+Planar feature tensor: channels() planes of rows() x cols() floats, stored one after the other in a
+single continuous block. Plane c is a plain 2-D cv::Mat view, and all planes together form the
+(channels() * rows()) x cols() matrix that mat() returns. That is also the layout of the stacked
+channel spectra of KCFTracker::fftFeatures, so both domains index channels the same way.
+*/
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+class FeatureTensor
+{
+public:
+    FeatureTensor() : _channels(0), _rows(0), _cols(0) {}
+
+    // Reuses the buffer when the sizes do not change
+    void create(int channels, int rows, int cols)
+    {
+        _data.create(channels * rows, cols, CV_32F);
+        _channels = channels;
+        _rows = rows;
+        _cols = cols;
+    }
+
+    int channels() const { return _channels; }
+    int rows() const { return _rows; }
+    int cols() const { return _cols; }
+
+    // rows() x cols() view of channel c
+    cv::Mat plane(int c) const { return _data.rowRange(c * _rows, (c + 1) * _rows); }
+
+    // Channels [begin, end) stacked vertically
+    cv::Mat planes(int begin, int end) const { return _data.rowRange(begin * _rows, end * _rows); }
+
+    // Start of channel c, whose rows() * cols() floats follow it
+    float *ptr(int c) { return _data.ptr<float>(c * _rows); }
+    const float *ptr(int c) const { return _data.ptr<float>(c * _rows); }
+
+    const cv::Mat &mat() const { return _data; }
+
+private:
+    cv::Mat _data;
+    int _channels;
+    int _rows;
+    int _cols;
+};
@@ -36,15 +36,28 @@ the use of this software, even if advised of the possibility of such damage.
 #pragma once
 
 //#include <cv.h>
+#include <algorithm>
 
 #ifndef _OPENCV_FFTTOOLS_HPP_
 #define _OPENCV_FFTTOOLS_HPP_
 #endif
 
-//NOTE: FFTW support is still shaky, disabled for now.
-/*#ifdef USE_FFTW
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// FFT backend, selected at build time (see FFT_BACKEND in CMakeLists.txt).
+// USE_FFTW routes the fixed-size real transforms of DFTPlan through FFTW plans,
+// otherwise everything goes through cv::dft.
+#ifdef USE_FFTW
 #include <fftw3.h>
-#endif*/
+#include <cstring>
+#include <mutex>
+#endif
 
 namespace FFTTools
 {
@@ -56,60 +69,23 @@ cv::Mat magnitude(cv::Mat img);
 cv::Mat complexMultiplication(cv::Mat a, cv::Mat b);
 cv::Mat complexDivisionReal(cv::Mat a, cv::Mat b);
 cv::Mat complexDivision(cv::Mat a, cv::Mat b);
+void complexMultiplication(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst);
+void complexDivisionReal(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst);
+void complexDivision(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst);
+void complexMultiplicationKernel(const float *a, const float *b, float *dst, int n);
+void complexDivisionRealKernel(const float *a, const float *b, float *dst, int n);
+void complexDivisionKernel(const float *a, const float *b, float *dst, int n);
+void mulSpectrumRows(const cv::Mat &row, const cv::Mat &b, cv::Mat &dst);
+void fftdCCS(const cv::Mat &src, cv::Mat &dst, bool backwards = false);
+void ccsDivision(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst);
+void resizeSpectrum(const cv::Mat &src, cv::Mat &dst, int cols);
+double ccsEnergy(const cv::Mat &a);
 void rearrange(cv::Mat &img);
 void normalizedLogTransform(cv::Mat &img);
 
 
 cv::Mat fftd(cv::Mat img, bool backwards, bool byRow)
 {
-/*
-#ifdef USE_FFTW
-
-    fftw_complex * fm = (fftw_complex*) fftw_malloc(sizeof (fftw_complex) * img.cols * img.rows);
-
-    fftw_plan p = fftw_plan_dft_2d(img.rows, img.cols, fm, fm, backwards ? 1 : -1, 0 * FFTW_ESTIMATE);
-
-
-    if (img.channels() == 1)
-    {
-        for (int i = 0; i < img.rows; i++)
-            for (int j = 0; j < img.cols; j++)
-            {
-                fm[i * img.cols + j][0] = img.at<float>(i, j);
-                fm[i * img.cols + j][1] = 0;
-            }
-    }
-    else
-    {
-        assert(img.channels() == 2);
-        for (int i = 0; i < img.rows; i++)
-            for (int j = 0; j < img.cols; j++)
-            {
-                fm[i * img.cols + j][0] = img.at<cv::Vec2d > (i, j)[0];
-                fm[i * img.cols + j][1] = img.at<cv::Vec2d > (i, j)[1];
-            }
-    }
-    fftw_execute(p);
-    cv::Mat res(img.rows, img.cols, CV_64FC2);
-
-
-    for (int i = 0; i < img.rows; i++)
-        for (int j = 0; j < img.cols; j++)
-        {
-            res.at<cv::Vec2d > (i, j)[0] = fm[i * img.cols + j][0];
-            res.at<cv::Vec2d > (i, j)[1] = fm[i * img.cols + j][1];
-
-            //  _iout(fm[i * img.cols + j][0]);
-        }
-
-    if (backwards)res *= 1.d / (float) (res.cols * res.rows);
-
-    fftw_free(p);
-    fftw_free(fm);
-    return res;
-
-#else
-*/
     if (img.channels() == 1)
     {
         cv::Mat planes[] = {cv::Mat_<float> (img), cv::Mat_<float>::zeros(img.size())};
@@ -122,9 +98,6 @@ cv::Mat fftd(cv::Mat img, bool backwards, bool byRow)
       cv::dft(img, img, backwards ? (cv::DFT_INVERSE | cv::DFT_SCALE) : 0 );
 
     return img;
-
-/*#endif*/
-
 }
 
 cv::Mat real(cv::Mat img)
@@ -152,57 +125,469 @@ cv::Mat magnitude(cv::Mat img)
     return res;
 }
 
-cv::Mat complexMultiplication(cv::Mat a, cv::Mat b)
-{
-    std::vector<cv::Mat> pa;
-    std::vector<cv::Mat> pb;
-    cv::split(a, pa);
-    cv::split(b, pb);
+// Element-wise kernels on interleaved complex data (re, im, re, im, ...).
+// n is the number of complex elements; dst may point to the same data as a.
+// The vector paths evaluate the same expressions as the scalar tails, so all paths give identical results.
 
-    std::vector<cv::Mat> pres;
-    pres.push_back(pa[0].mul(pb[0]) - pa[1].mul(pb[1]));
-    pres.push_back(pa[0].mul(pb[1]) + pa[1].mul(pb[0]));
+// dst = a * b
+void complexMultiplicationKernel(const float *a, const float *b, float *dst, int n)
+{
+    int i = 0;
+#if defined(__AVX__)
+    for (; i <= n - 4; i += 4)
+    {
+        __m256 va = _mm256_loadu_ps(a + 2 * i);
+        __m256 vb = _mm256_loadu_ps(b + 2 * i);
+        __m256 t1 = _mm256_mul_ps(_mm256_moveldup_ps(va), vb);                            // ar*br, ar*bi
+        __m256 t2 = _mm256_mul_ps(_mm256_movehdup_ps(va), _mm256_permute_ps(vb, 0xB1));   // ai*bi, ai*br
+        _mm256_storeu_ps(dst + 2 * i, _mm256_addsub_ps(t1, t2));
+    }
+#elif defined(__SSE2__)
+    const __m128 sign = _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+    for (; i <= n - 2; i += 2)
+    {
+        __m128 va = _mm_loadu_ps(a + 2 * i);
+        __m128 vb = _mm_loadu_ps(b + 2 * i);
+        __m128 t1 = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 2, 0, 0)), vb);
+        __m128 t2 = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 3, 1, 1)), _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(dst + 2 * i, _mm_add_ps(t1, _mm_xor_ps(t2, sign)));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i <= n - 4; i += 4)
+    {
+        float32x4x2_t va = vld2q_f32(a + 2 * i);
+        float32x4x2_t vb = vld2q_f32(b + 2 * i);
+        float32x4x2_t vr;
+        vr.val[0] = vsubq_f32(vmulq_f32(va.val[0], vb.val[0]), vmulq_f32(va.val[1], vb.val[1]));
+        vr.val[1] = vaddq_f32(vmulq_f32(va.val[0], vb.val[1]), vmulq_f32(va.val[1], vb.val[0]));
+        vst2q_f32(dst + 2 * i, vr);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        float ar = a[2 * i], ai = a[2 * i + 1];
+        float br = b[2 * i], bi = b[2 * i + 1];
+        dst[2 * i    ] = ar * br - ai * bi;
+        dst[2 * i + 1] = ar * bi + ai * br;
+    }
+}
 
-    cv::Mat res;
-    cv::merge(pres, res);
+// dst = a / b, with b real (one float per complex element of a)
+void complexDivisionRealKernel(const float *a, const float *b, float *dst, int n)
+{
+    int i = 0;
+#if defined(__AVX__)
+    for (; i <= n - 4; i += 4)
+    {
+        __m128 vb = _mm_loadu_ps(b + i);
+        __m256 vbb = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_unpacklo_ps(vb, vb)), _mm_unpackhi_ps(vb, vb), 1);
+        _mm256_storeu_ps(dst + 2 * i, _mm256_div_ps(_mm256_loadu_ps(a + 2 * i), vbb));
+    }
+#elif defined(__SSE2__)
+    for (; i <= n - 2; i += 2)
+    {
+        __m128 vb = _mm_castpd_ps(_mm_load_sd((const double *)(b + i)));
+        _mm_storeu_ps(dst + 2 * i, _mm_div_ps(_mm_loadu_ps(a + 2 * i), _mm_unpacklo_ps(vb, vb)));
+    }
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+    for (; i <= n - 4; i += 4)
+    {
+        float32x4x2_t va = vld2q_f32(a + 2 * i);
+        float32x4_t vb = vld1q_f32(b + i);
+        va.val[0] = vdivq_f32(va.val[0], vb);
+        va.val[1] = vdivq_f32(va.val[1], vb);
+        vst2q_f32(dst + 2 * i, va);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        dst[2 * i    ] = a[2 * i    ] / b[i];
+        dst[2 * i + 1] = a[2 * i + 1] / b[i];
+    }
+}
 
-    return res;
+// dst = a / b
+void complexDivisionKernel(const float *a, const float *b, float *dst, int n)
+{
+    int i = 0;
+#if defined(__AVX__)
+    const __m256 sign = _mm256_castsi256_ps(_mm256_set_epi32((int)0x80000000, 0, (int)0x80000000, 0, (int)0x80000000, 0, (int)0x80000000, 0));
+    for (; i <= n - 4; i += 4)
+    {
+        __m256 va = _mm256_loadu_ps(a + 2 * i);
+        __m256 vb = _mm256_loadu_ps(b + 2 * i);
+        __m256 t1 = _mm256_mul_ps(_mm256_moveldup_ps(va), vb);                            // ar*br, ar*bi
+        __m256 t2 = _mm256_mul_ps(_mm256_movehdup_ps(va), _mm256_permute_ps(vb, 0xB1));   // ai*bi, ai*br
+        __m256 num = _mm256_add_ps(_mm256_xor_ps(t1, sign), t2);                          // ar*br + ai*bi, ai*br - ar*bi
+        __m256 bb = _mm256_mul_ps(vb, vb);
+        __m256 den = _mm256_add_ps(bb, _mm256_permute_ps(bb, 0xB1));
+        _mm256_storeu_ps(dst + 2 * i, _mm256_div_ps(num, den));
+    }
+#elif defined(__SSE2__)
+    const __m128 sign = _mm_castsi128_ps(_mm_set_epi32((int)0x80000000, 0, (int)0x80000000, 0));
+    for (; i <= n - 2; i += 2)
+    {
+        __m128 va = _mm_loadu_ps(a + 2 * i);
+        __m128 vb = _mm_loadu_ps(b + 2 * i);
+        __m128 t1 = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 2, 0, 0)), vb);
+        __m128 t2 = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 3, 1, 1)), _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1)));
+        __m128 num = _mm_add_ps(_mm_xor_ps(t1, sign), t2);
+        __m128 bb = _mm_mul_ps(vb, vb);
+        __m128 den = _mm_add_ps(bb, _mm_shuffle_ps(bb, bb, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(dst + 2 * i, _mm_div_ps(num, den));
+    }
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+    for (; i <= n - 4; i += 4)
+    {
+        float32x4x2_t va = vld2q_f32(a + 2 * i);
+        float32x4x2_t vb = vld2q_f32(b + 2 * i);
+        float32x4_t den = vaddq_f32(vmulq_f32(vb.val[0], vb.val[0]), vmulq_f32(vb.val[1], vb.val[1]));
+        float32x4x2_t vr;
+        vr.val[0] = vdivq_f32(vaddq_f32(vmulq_f32(va.val[0], vb.val[0]), vmulq_f32(va.val[1], vb.val[1])), den);
+        vr.val[1] = vdivq_f32(vsubq_f32(vmulq_f32(va.val[1], vb.val[0]), vmulq_f32(va.val[0], vb.val[1])), den);
+        vst2q_f32(dst + 2 * i, vr);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        float ar = a[2 * i], ai = a[2 * i + 1];
+        float br = b[2 * i], bi = b[2 * i + 1];
+        float den = br * br + bi * bi;
+        dst[2 * i    ] = (ar * br + ai * bi) / den;
+        dst[2 * i + 1] = (ai * br - ar * bi) / den;
+    }
 }
 
-cv::Mat complexDivisionReal(cv::Mat a, cv::Mat b)
+// Row-wise drivers for CV_32FC2 matrices, dst is (re)allocated only if its size or type differs
+void complexMultiplication(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst)
 {
-    std::vector<cv::Mat> pa;
-    cv::split(a, pa);
+    assert(a.type() == CV_32FC2 && b.type() == CV_32FC2 && a.size() == b.size());
+    dst.create(a.size(), CV_32FC2);
+    for (int i = 0; i < a.rows; i++)
+        complexMultiplicationKernel(a.ptr<float>(i), b.ptr<float>(i), dst.ptr<float>(i), a.cols);
+}
 
-    std::vector<cv::Mat> pres;
+void complexDivisionReal(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst)
+{
+    assert(a.type() == CV_32FC2 && b.type() == CV_32FC1 && a.size() == b.size());
+    dst.create(a.size(), CV_32FC2);
+    for (int i = 0; i < a.rows; i++)
+        complexDivisionRealKernel(a.ptr<float>(i), b.ptr<float>(i), dst.ptr<float>(i), a.cols);
+}
 
-    cv::Mat divisor = 1. / b;
+void complexDivision(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst)
+{
+    assert(a.type() == CV_32FC2 && b.type() == CV_32FC2 && a.size() == b.size());
+    dst.create(a.size(), CV_32FC2);
+    for (int i = 0; i < a.rows; i++)
+        complexDivisionKernel(a.ptr<float>(i), b.ptr<float>(i), dst.ptr<float>(i), a.cols);
+}
 
-    pres.push_back(pa[0].mul(divisor));
-    pres.push_back(pa[1].mul(divisor));
+cv::Mat complexMultiplication(cv::Mat a, cv::Mat b)
+{
+    cv::Mat res;
+    complexMultiplication(a, b, res);
+    return res;
+}
 
+cv::Mat complexDivisionReal(cv::Mat a, cv::Mat b)
+{
     cv::Mat res;
-    cv::merge(pres, res);
+    complexDivisionReal(a, b, res);
     return res;
 }
 
 cv::Mat complexDivision(cv::Mat a, cv::Mat b)
 {
-    std::vector<cv::Mat> pa;
-    std::vector<cv::Mat> pb;
-    cv::split(a, pa);
-    cv::split(b, pb);
+    cv::Mat res;
+    complexDivision(a, b, res);
+    return res;
+}
+
+// dst = row * conj(b) for every row of the complex spectra b, the same as cv::mulSpectrums(repeat(row), b, dst, 0, true)
+void mulSpectrumRows(const cv::Mat &row, const cv::Mat &b, cv::Mat &dst)
+{
+    assert(row.type() == CV_32FC2 && b.type() == CV_32FC2 && row.rows == 1 && row.cols == b.cols);
+    dst.create(b.size(), CV_32FC2);
+    const float *r = row.ptr<float>(0);
+    for (int i = 0; i < b.rows; i++)
+    {
+        const float *pb = b.ptr<float>(i);
+        float *pd = dst.ptr<float>(i);
+        for (int j = 0; j < 2 * b.cols; j += 2)
+        {
+            float re = r[j] * pb[j] + r[j + 1] * pb[j + 1];
+            float im = r[j + 1] * pb[j] - r[j] * pb[j + 1];
+            pd[j] = re;
+            pd[j + 1] = im;
+        }
+    }
+}
 
-    cv::Mat divisor = 1. / (pb[0].mul(pb[0]) + pb[1].mul(pb[1]));
+// Packed spectra of real-valued 2-D signals.
+// cv::dft without DFT_COMPLEX_OUTPUT stores the Hermitian half of the spectrum of a real MxN
+// input in an MxN single-channel matrix (CCS format):
+//   - columns 1 .. (N-1)/2*2 hold interleaved (re, im) pairs of every row,
+//   - column 0, and column N-1 when N is even, hold the purely real first row element,
+//     (re, im) pairs down the column, and a purely real last row element when M is even.
+// cv::mulSpectrums understands this layout, the helpers below cover the rest.
 
-    std::vector<cv::Mat> pres;
+// Forward real -> CCS transform, or the inverse CCS -> real transform (scaled) with backwards
+void fftdCCS(const cv::Mat &src, cv::Mat &dst, bool backwards)
+{
+    assert(src.type() == CV_32FC1);
+    cv::dft(src, dst, backwards ? (cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT) : 0);
+}
 
-    pres.push_back((pa[0].mul(pb[0]) + pa[1].mul(pb[1])).mul(divisor));
-    pres.push_back((pa[1].mul(pb[0]) + pa[0].mul(pb[1])).mul(divisor));
+// dst = a / b for CCS packed spectra of the same size
+void ccsDivision(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst)
+{
+    assert(a.type() == CV_32FC1 && b.type() == CV_32FC1 && a.size() == b.size());
+    int rows = a.rows;
+    int cols = a.cols;
+    dst.create(a.size(), CV_32FC1);
 
-    cv::Mat res;
-    cv::merge(pres, res);
-    return res;
+    // Columns holding the spectra of the real DFT columns
+    for (int j = 0; j < cols; j += (cols % 2 == 0 && cols > 1) ? cols - 1 : cols)
+    {
+        dst.at<float>(0, j) = a.at<float>(0, j) / b.at<float>(0, j);
+        int i = 1;
+        for (; i + 1 < rows; i += 2)
+        {
+            float pa[2] = {a.at<float>(i, j), a.at<float>(i + 1, j)};
+            float pb[2] = {b.at<float>(i, j), b.at<float>(i + 1, j)};
+            complexDivisionKernel(pa, pb, pa, 1);
+            dst.at<float>(i, j) = pa[0];
+            dst.at<float>(i + 1, j) = pa[1];
+        }
+        if (i < rows)
+            dst.at<float>(i, j) = a.at<float>(i, j) / b.at<float>(i, j);
+    }
+
+    // Interleaved pairs of every row
+    int pairs = (cols - 1) / 2;
+    for (int i = 0; i < rows; i++)
+        complexDivisionKernel(a.ptr<float>(i) + 1, b.ptr<float>(i) + 1, dst.ptr<float>(i) + 1, pairs);
+}
+
+// Energy of the full spectrum (sum of |X|^2 over all MxN bins) from its CCS packed half.
+// Every packed value stands for a bin and its conjugate mirror, except the purely real
+// self-mirrored bins in the corners.
+double ccsEnergy(const cv::Mat &a)
+{
+    int rows = a.rows;
+    int cols = a.cols;
+    double energy = 2 * cv::norm(a, cv::NORM_L2SQR);
+    double c;
+    c = a.at<float>(0, 0);
+    energy -= c * c;
+    if (rows % 2 == 0) {
+        c = a.at<float>(rows - 1, 0);
+        energy -= c * c;
+    }
+    if (cols % 2 == 0) {
+        c = a.at<float>(0, cols - 1);
+        energy -= c * c;
+        if (rows % 2 == 0) {
+            c = a.at<float>(rows - 1, cols - 1);
+            energy -= c * c;
+        }
+    }
+    return energy;
+}
+
+// Forward and inverse real transforms of one fixed size (CCS packed spectra, as fftdCCS).
+// Plans are built once by create() and reused for every transform of that size.
+class DFTPlan
+{
+public:
+    DFTPlan() : _rows(0), _cols(0)
+#ifdef USE_FFTW
+        , _in(NULL), _out(NULL), _forward(NULL), _inverse(NULL)
+#endif
+    {}
+
+    ~DFTPlan() { release(); }
+
+    void create(int rows, int cols)
+    {
+        if (rows == _rows && cols == _cols)
+            return;
+        release();
+        _rows = rows;
+        _cols = cols;
+#ifdef USE_FFTW
+        std::lock_guard<std::mutex> lock(planner());
+        _in = fftwf_alloc_real(rows * cols);
+        _out = fftwf_alloc_complex(rows * (cols / 2 + 1));
+        _forward = fftwf_plan_dft_r2c_2d(rows, cols, _in, _out, FFTW_MEASURE);
+        _inverse = fftwf_plan_dft_c2r_2d(rows, cols, _out, _in, FFTW_MEASURE);
+#endif
+    }
+
+    int rows() const { return _rows; }
+    int cols() const { return _cols; }
+
+    // Real src -> CCS packed dst
+    void forward(const cv::Mat &src, cv::Mat &dst)
+    {
+        assert(src.type() == CV_32FC1 && src.rows == _rows && src.cols == _cols);
+#ifdef USE_FFTW
+        for (int i = 0; i < _rows; i++)
+            memcpy(_in + i * _cols, src.ptr<float>(i), _cols * sizeof(float));
+        fftwf_execute(_forward);
+        dst.create(_rows, _cols, CV_32FC1);
+        pack(dst);
+#else
+        fftdCCS(src, dst);
+#endif
+    }
+
+    // CCS packed src -> real dst, scaled by 1 / (rows * cols)
+    void inverse(const cv::Mat &src, cv::Mat &dst)
+    {
+        assert(src.type() == CV_32FC1 && src.rows == _rows && src.cols == _cols);
+#ifdef USE_FFTW
+        unpack(src);
+        fftwf_execute(_inverse);
+        dst.create(_rows, _cols, CV_32FC1);
+        float scale = 1.f / (_rows * _cols);
+        for (int i = 0; i < _rows; i++) {
+            const float *in = _in + i * _cols;
+            float *out = dst.ptr<float>(i);
+            for (int j = 0; j < _cols; j++)
+                out[j] = in[j] * scale;
+        }
+#else
+        fftdCCS(src, dst, true);
+#endif
+    }
+
+private:
+    DFTPlan(const DFTPlan &);
+    DFTPlan &operator=(const DFTPlan &);
+
+    int _rows;
+    int _cols;
+
+    void release()
+    {
+#ifdef USE_FFTW
+        std::lock_guard<std::mutex> lock(planner());
+        if (_forward) fftwf_destroy_plan(_forward);
+        if (_inverse) fftwf_destroy_plan(_inverse);
+        if (_in) fftwf_free(_in);
+        if (_out) fftwf_free(_out);
+        _in = NULL;
+        _out = NULL;
+        _forward = NULL;
+        _inverse = NULL;
+#endif
+        _rows = 0;
+        _cols = 0;
+    }
+
+#ifdef USE_FFTW
+    // Creating and destroying FFTW plans is not thread safe, executing them is. Every plan of the
+    // process is made and destroyed under this lock.
+    static std::mutex &planner()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // FFTW keeps the rows x (cols/2+1) half spectrum, convert it from and to the CCS layout
+
+    // Pack column j of the half spectrum (a real DFT column) into CCS column c
+    void packColumn(cv::Mat &dst, int j, int c)
+    {
+        int hw = _cols / 2 + 1;
+        dst.at<float>(0, c) = _out[j][0];
+        int i = 1;
+        for (; i + 1 < _rows; i += 2) {
+            dst.at<float>(i, c) = _out[((i + 1) / 2) * hw + j][0];
+            dst.at<float>(i + 1, c) = _out[((i + 1) / 2) * hw + j][1];
+        }
+        if (i < _rows)
+            dst.at<float>(i, c) = _out[(_rows / 2) * hw + j][0];
+    }
+
+    void unpackColumn(const cv::Mat &src, int j, int c)
+    {
+        int hw = _cols / 2 + 1;
+        _out[j][0] = src.at<float>(0, c);
+        _out[j][1] = 0;
+        int i = 1;
+        for (; i + 1 < _rows; i += 2) {
+            int k = (i + 1) / 2;
+            _out[k * hw + j][0] = src.at<float>(i, c);
+            _out[k * hw + j][1] = src.at<float>(i + 1, c);
+            _out[(_rows - k) * hw + j][0] = src.at<float>(i, c);
+            _out[(_rows - k) * hw + j][1] = -src.at<float>(i + 1, c);
+        }
+        if (i < _rows) {
+            _out[(_rows / 2) * hw + j][0] = src.at<float>(i, c);
+            _out[(_rows / 2) * hw + j][1] = 0;
+        }
+    }
+
+    void pack(cv::Mat &dst)
+    {
+        int hw = _cols / 2 + 1;
+        int pairs = (_cols - 1) / 2;
+        for (int i = 0; i < _rows; i++) {
+            float *out = dst.ptr<float>(i);
+            for (int j = 1; j <= pairs; j++) {
+                out[2 * j - 1] = _out[i * hw + j][0];
+                out[2 * j    ] = _out[i * hw + j][1];
+            }
+        }
+        packColumn(dst, 0, 0);
+        if (_cols % 2 == 0 && _cols > 1)
+            packColumn(dst, _cols / 2, _cols - 1);
+    }
+
+    void unpack(const cv::Mat &src)
+    {
+        int hw = _cols / 2 + 1;
+        int pairs = (_cols - 1) / 2;
+        for (int i = 0; i < _rows; i++) {
+            const float *in = src.ptr<float>(i);
+            for (int j = 1; j <= pairs; j++) {
+                _out[i * hw + j][0] = in[2 * j - 1];
+                _out[i * hw + j][1] = in[2 * j    ];
+            }
+        }
+        unpackColumn(src, 0, 0);
+        if (_cols % 2 == 0 && _cols > 1)
+            unpackColumn(src, _cols / 2, _cols - 1);
+    }
+
+    float *_in;
+    fftwf_complex *_out;
+    fftwf_plan _forward;
+    fftwf_plan _inverse;
+#endif
+};
+
+// Zero-pads (or truncates) the full complex spectrum of a row signal to cols bins, which resamples the
+// periodic signal to cols points. The result is scaled so that the signal keeps its amplitude.
+void resizeSpectrum(const cv::Mat &src, cv::Mat &dst, int cols)
+{
+    assert(src.rows == 1 && src.type() == CV_32FC2);
+    int n = std::min(src.cols, cols);
+    int positive = (n + 1) / 2; // DC and the positive frequencies
+    int negative = (n - 1) / 2; // the negative frequencies, taken from the end
+    double scaling = cols / (double) src.cols;
+
+    dst.create(1, cols, CV_32FC2);
+    dst.setTo(0);
+    cv::Mat dst_positive = dst.colRange(0, positive);
+    src.colRange(0, positive).convertTo(dst_positive, CV_32FC2, scaling);
+    if (negative > 0) {
+        cv::Mat dst_negative = dst.colRange(cols - negative, cols);
+        src.colRange(src.cols - negative, src.cols).convertTo(dst_negative, CV_32FC2, scaling);
+    }
 }
 
 void rearrange(cv::Mat &img)
@@ -211,18 +596,14 @@ void rearrange(cv::Mat &img)
     int cx = img.cols / 2;
     int cy = img.rows / 2;
 
-    cv::Mat q0(img, cv::Rect(0, 0, cx, cy)); // Top-Left - Create a ROI per quadrant
-    cv::Mat q1(img, cv::Rect(cx, 0, cx, cy)); // Top-Right
-    cv::Mat q2(img, cv::Rect(0, cy, cx, cy)); // Bottom-Left
-    cv::Mat q3(img, cv::Rect(cx, cy, cx, cy)); // Bottom-Right
-
-    cv::Mat tmp; // swap quadrants (Top-Left with Bottom-Right)
-    q0.copyTo(tmp);
-    q3.copyTo(q0);
-    tmp.copyTo(q3);
-    q1.copyTo(tmp); // swap quadrant (Top-Right with Bottom-Left)
-    q2.copyTo(q1);
-    tmp.copyTo(q2);
+    // Swap the quadrants in place, row by row: Top-Left with Bottom-Right, Top-Right with Bottom-Left
+    size_t half = cx * img.elemSize();
+    for (int y = 0; y < cy; y++) {
+        uchar *top = img.ptr<uchar>(y);
+        uchar *bottom = img.ptr<uchar>(y + cy);
+        std::swap_ranges(top, top + half, bottom + half);
+        std::swap_ranges(top + half, top + 2 * half, bottom);
+    }
 }
 /*
 template < typename type>
@@ -48,6 +48,26 @@
 
 #include "fhog.hpp"
 
+#include <string.h>
+
+// Vector kernels of gradientBins, doing the operations of the scalar code in the same order.
+// Compiled for the build target: NEON on AArch64. The AVX2 kernel is in fhog_avx2.cpp, built with
+// its own flags and chosen at run time; FHOG_HAVE_AVX2 is set where CMakeLists.txt builds it.
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define FHOG_SIMD_WIDTH 4
+#else
+#define FHOG_SIMD_WIDTH 1
+#endif
+
+#ifdef FHOG_HAVE_AVX2
+#include <opencv2/core/core.hpp>
+
+// Bins count pixels from dx, dy with the AVX2 kernel, returns how many it did (a multiple of 8)
+int gradientBinsAVX2(const float *dx, const float *dy, int numChannels,
+                     const float *boundary_x, const float *boundary_y, float *r, int *alfa, int count);
+#endif
+
 
 #ifdef HAVE_TBB
 #include <tbb/tbb.h>
@@ -64,64 +84,175 @@
 #endif
 
 
-/*
-// Getting feature map for the selected subimage
-//
-// API
-// int getFeatureMaps(const IplImage * image, const int k, featureMap **map);
-// INPUT
-// image             - selected subimage
-// k                 - size of cells
-// OUTPUT
-// map               - feature map
-// RESULT
-// Error status
-*/
-int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade **map)
+// Grow a scratch buffer of a workspace to hold at least size bytes.
+// The old contents are not preserved.
+static void *reserveBuffer(void *buf, int *capacity, int size, int *allocations)
 {
-    int sizeX, sizeY;
-    int p, px, stringSize;
-    int height, width, numChannels;
-    int i, j, kk, c, ii, jj, d;
-    float  * datadx, * datady;
-    
-    int   ch; 
-    float magnitude, x, y, tx, ty;
-    
-    IplImage * dx, * dy;
-    int *nearest;
-    float *w, a_x, b_x;
+    if (size <= *capacity)
+        return buf;
+    free(buf);
+    *capacity = size;
+    if (allocations)
+        (*allocations)++;
+    return malloc(size);
+}
 
-    float kernel[3] = {-1.f, 0.f, 1.f};
-    CvMat kernel_dx = cvMat(1, 3, CV_32F, kernel);
-    CvMat kernel_dy = cvMat(3, 1, CV_32F, kernel);
+// Cell weights of the bilinear splatting into the neighbouring cells
+static void cellWeights(const int k, int *nearest, float *w)
+{
+    int i, j;
+    float a_x, b_x;
 
-    float * r;
-    int   * alfa;
-    
-    float boundary_x[NUM_SECTOR + 1];
-    float boundary_y[NUM_SECTOR + 1];
+    for(i = 0; i < k / 2; i++)
+    {
+        nearest[i] = -1;
+    }/*for(i = 0; i < k / 2; i++)*/
+    for(i = k / 2; i < k; i++)
+    {
+        nearest[i] = 1;
+    }/*for(i = k / 2; i < k; i++)*/
+
+    for(j = 0; j < k / 2; j++)
+    {
+        b_x = k / 2 + j + 0.5f;
+        a_x = k / 2 - j - 0.5f;
+        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
+        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
+    }/*for(j = 0; j < k / 2; j++)*/
+    for(j = k / 2; j < k; j++)
+    {
+        a_x = j - k / 2 + 0.5f;
+        b_x =-j + k / 2 - 0.5f + k;
+        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
+        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
+    }/*for(j = k / 2; j < k; j++)*/
+}
+
+// Gradient magnitude r and orientation bins alfa (contrast insensitive, sensitive) of one pixel,
+// from the channel with the strongest gradient
+static inline void gradientBinPixel(const float *dx, const float *dy, int numChannels,
+                                    const float *boundary_x, const float *boundary_y, float *r, int *alfa)
+{
+    int kk, ch;
+    float magnitude, x, y, tx, ty;
     float max, dotProd;
     int   maxi;
 
-    height = image->height;
-    width  = image->width ;
+    x = dx[0];
+    y = dy[0];
 
-    numChannels = image->nChannels;
+    *r = sqrtf(x * x + y * y);
+    for(ch = 1; ch < numChannels; ch++)
+    {
+        tx = dx[ch];
+        ty = dy[ch];
+        magnitude = sqrtf(tx * tx + ty * ty);
+        if(magnitude > *r)
+        {
+            *r = magnitude;
+            x = tx;
+            y = ty;
+        }
+    }/*for(ch = 1; ch < numChannels; ch++)*/
 
-    dx    = cvCreateImage(cvSize(image->width, image->height), IPL_DEPTH_32F, image->nChannels);
-    dy    = cvCreateImage(cvSize(image->width, image->height), IPL_DEPTH_32F, image->nChannels);
+    max  = boundary_x[0] * x + boundary_y[0] * y;
+    maxi = 0;
+    for (kk = 0; kk < NUM_SECTOR; kk++) 
+    {
+        dotProd = boundary_x[kk] * x + boundary_y[kk] * y;
+        if (dotProd > max) 
+        {
+            max  = dotProd;
+            maxi = kk;
+        }
+        else 
+        {
+            if (-dotProd > max) 
+            {
+                max  = -dotProd;
+                maxi = kk + NUM_SECTOR;
+            }
+        }
+    }
+    alfa[0] = maxi % NUM_SECTOR;
+    alfa[1] = maxi;
+}
 
-    sizeX = width  / k;
-    sizeY = height / k;
-    px    = 3 * NUM_SECTOR; 
-    p     = px;
-    stringSize = sizeX * p;
-    allocFeatureMapObject(map, sizeX, sizeY, p);
+#if FHOG_SIMD_WIDTH == 4
+// gradientBinPixel for 4 consecutive pixels
+static inline void gradientBinBlock(const float *dx, const float *dy, int numChannels,
+                                    const float *boundary_x, const float *boundary_y, float *r, int *alfa)
+{
+    float32x4_t x, y, best;
+    float32x4_t cx[3], cy[3];
+    int ch, kk;
+
+    if (numChannels == 1) {
+        cx[0] = vld1q_f32(dx);
+        cy[0] = vld1q_f32(dy);
+    } else {
+        float32x4x3_t tx = vld3q_f32(dx);
+        float32x4x3_t ty = vld3q_f32(dy);
+        for (ch = 0; ch < 3; ch++) {
+            cx[ch] = tx.val[ch];
+            cy[ch] = ty.val[ch];
+        }
+    }
+    x = cx[0];
+    y = cy[0];
+    best = vsqrtq_f32(vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y)));
+    for (ch = 1; ch < numChannels; ch++) {
+        float32x4_t magnitude = vsqrtq_f32(vaddq_f32(vmulq_f32(cx[ch], cx[ch]), vmulq_f32(cy[ch], cy[ch])));
+        uint32x4_t stronger = vcgtq_f32(magnitude, best);
+        best = vbslq_f32(stronger, magnitude, best);
+        x = vbslq_f32(stronger, cx[ch], x);
+        y = vbslq_f32(stronger, cy[ch], y);
+    }
+    vst1q_f32(r, best);
+
+    float32x4_t max = vaddq_f32(vmulq_f32(vdupq_n_f32(boundary_x[0]), x),
+                                vmulq_f32(vdupq_n_f32(boundary_y[0]), y));
+    int32x4_t maxi = vdupq_n_s32(0);
+    for (kk = 0; kk < NUM_SECTOR; kk++) {
+        float32x4_t dotProd = vaddq_f32(vmulq_f32(vdupq_n_f32(boundary_x[kk]), x),
+                                        vmulq_f32(vdupq_n_f32(boundary_y[kk]), y));
+        float32x4_t negProd = vnegq_f32(dotProd);
+        uint32x4_t above = vcgtq_f32(dotProd, max);
+        uint32x4_t below = vbicq_u32(vcgtq_f32(negProd, max), above);
+        max = vbslq_f32(below, negProd, vbslq_f32(above, dotProd, max));
+        maxi = vbslq_s32(above, vdupq_n_s32(kk), maxi);
+        maxi = vbslq_s32(below, vdupq_n_s32(kk + NUM_SECTOR), maxi);
+    }
+
+    int bins[4];
+    vst1q_s32(bins, maxi);
+    for (kk = 0; kk < 4; kk++) {
+        alfa[kk * 2    ] = bins[kk] % NUM_SECTOR;
+        alfa[kk * 2 + 1] = bins[kk];
+    }
+}
+#endif
+
+// Gradient magnitude r and orientation bins alfa (contrast insensitive, sensitive) of every pixel
+static void gradientBins(const IplImage * dx, const IplImage * dy, float *r, int *alfa)
+{
+    int height, width, numChannels;
+    int i, j;
+    float  * datadx, * datady;
+    float boundary_x[NUM_SECTOR + 1];
+    float boundary_y[NUM_SECTOR + 1];
+
+    height = dx->height;
+    width  = dx->width ;
+    numChannels = dx->nChannels;
+#ifdef FHOG_HAVE_AVX2
+#ifdef CV_CPU_AVX2
+    static const bool avx2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+#else
+    static const bool avx2 = __builtin_cpu_supports("avx2"); // OpenCV versions without the AVX2 flag
+#endif
+#endif
 
-    cvFilter2D(image, dx, &kernel_dx, cvPoint(-1, 0));
-    cvFilter2D(image, dy, &kernel_dy, cvPoint(0, -1));
-    
     float arg_vector;
     for(i = 0; i <= NUM_SECTOR; i++)
     {
@@ -130,84 +261,43 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
         boundary_y[i] = sinf(arg_vector);
     }/*for(i = 0; i <= NUM_SECTOR; i++) */
 
-    r    = (float *)malloc( sizeof(float) * (width * height));
-    alfa = (int   *)malloc( sizeof(int  ) * (width * height * 2));
-
     for(j = 1; j < height - 1; j++)
     {
         datadx = (float*)(dx->imageData + dx->widthStep * j);
         datady = (float*)(dy->imageData + dy->widthStep * j);
-        for(i = 1; i < width - 1; i++)
+        i = 1;
+        // The vector kernels handle one and three channel images
+        if (numChannels == 1 || numChannels == 3)
         {
-            c = 0;
-            x = (datadx[i * numChannels + c]);
-            y = (datady[i * numChannels + c]);
-
-            r[j * width + i] =sqrtf(x * x + y * y);
-            for(ch = 1; ch < numChannels; ch++)
-            {
-                tx = (datadx[i * numChannels + ch]);
-                ty = (datady[i * numChannels + ch]);
-                magnitude = sqrtf(tx * tx + ty * ty);
-                if(magnitude > r[j * width + i])
-                {
-                    r[j * width + i] = magnitude;
-                    c = ch;
-                    x = tx;
-                    y = ty;
-                }
-            }/*for(ch = 1; ch < numChannels; ch++)*/
-            
-            max  = boundary_x[0] * x + boundary_y[0] * y;
-            maxi = 0;
-            for (kk = 0; kk < NUM_SECTOR; kk++) 
+#ifdef FHOG_HAVE_AVX2
+            if (avx2)
+                i += gradientBinsAVX2(datadx + i * numChannels, datady + i * numChannels, numChannels,
+                                      boundary_x, boundary_y, r + j * width + i, alfa + j * width * 2 + i * 2, width - 1 - i);
+#endif
+#if FHOG_SIMD_WIDTH > 1
+            for(; i + FHOG_SIMD_WIDTH <= width - 1; i += FHOG_SIMD_WIDTH)
             {
-                dotProd = boundary_x[kk] * x + boundary_y[kk] * y;
-                if (dotProd > max) 
-                {
-                    max  = dotProd;
-                    maxi = kk;
-                }
-                else 
-                {
-                    if (-dotProd > max) 
-                    {
-                        max  = -dotProd;
-                        maxi = kk + NUM_SECTOR;
-                    }
-                }
+                gradientBinBlock(datadx + i * numChannels, datady + i * numChannels, numChannels,
+                                 boundary_x, boundary_y, r + j * width + i, alfa + j * width * 2 + i * 2);
             }
-            alfa[j * width * 2 + i * 2    ] = maxi % NUM_SECTOR;
-            alfa[j * width * 2 + i * 2 + 1] = maxi;  
+#endif
+        }
+        for(; i < width - 1; i++)
+        {
+            gradientBinPixel(datadx + i * numChannels, datady + i * numChannels, numChannels,
+                             boundary_x, boundary_y, r + j * width + i, alfa + j * width * 2 + i * 2);
         }/*for(i = 0; i < width; i++)*/
     }/*for(j = 0; j < height; j++)*/
+}
 
-    nearest = (int  *)malloc(sizeof(int  ) *  k);
-    w       = (float*)malloc(sizeof(float) * (k * 2));
-    
-    for(i = 0; i < k / 2; i++)
-    {
-        nearest[i] = -1;
-    }/*for(i = 0; i < k / 2; i++)*/
-    for(i = k / 2; i < k; i++)
-    {
-        nearest[i] = 1;
-    }/*for(i = k / 2; i < k; i++)*/
-
-    for(j = 0; j < k / 2; j++)
-    {
-        b_x = k / 2 + j + 0.5f;
-        a_x = k / 2 - j - 0.5f;
-        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
-        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
-    }/*for(j = 0; j < k / 2; j++)*/
-    for(j = k / 2; j < k; j++)
-    {
-        a_x = j - k / 2 + 0.5f;
-        b_x =-j + k / 2 - 0.5f + k;
-        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
-        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
-    }/*for(j = k / 2; j < k; j++)*/
+// Splat the oriented magnitudes into the (zeroed) histograms of the cells
+static void cellHistograms(const float *r, const int *alfa, const int width, const int height,
+                           const int k, const int *nearest, const float *w, CvLSVMFeatureMapCaskade *map)
+{
+    int i, j, ii, jj, d;
+    int sizeX = map->sizeX;
+    int sizeY = map->sizeY;
+    int stringSize = sizeX * map->numFeatures;
 
     for(i = 0; i < sizeY; i++)
     {
@@ -223,24 +313,24 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
                 (j * k + jj < width  - 1))
             {
               d = (k * i + ii) * width + (j * k + jj);
-              (*map)->map[ i * stringSize + j * (*map)->numFeatures + alfa[d * 2    ]] += 
+              map->map[ i * stringSize + j * map->numFeatures + alfa[d * 2    ]] += 
                   r[d] * w[ii * 2] * w[jj * 2];
-              (*map)->map[ i * stringSize + j * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+              map->map[ i * stringSize + j * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2] * w[jj * 2];
               if ((i + nearest[ii] >= 0) && 
                   (i + nearest[ii] <= sizeY - 1))
               {
-                (*map)->map[(i + nearest[ii]) * stringSize + j * (*map)->numFeatures + alfa[d * 2    ]             ] += 
+                map->map[(i + nearest[ii]) * stringSize + j * map->numFeatures + alfa[d * 2    ]             ] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 ];
-                (*map)->map[(i + nearest[ii]) * stringSize + j * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+                map->map[(i + nearest[ii]) * stringSize + j * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 ];
               }
               if ((j + nearest[jj] >= 0) && 
                   (j + nearest[jj] <= sizeX - 1))
               {
-                (*map)->map[i * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2    ]             ] += 
+                map->map[i * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2    ]             ] += 
                   r[d] * w[ii * 2] * w[jj * 2 + 1];
-                (*map)->map[i * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+                map->map[i * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2] * w[jj * 2 + 1];
               }
               if ((i + nearest[ii] >= 0) && 
@@ -248,9 +338,9 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
                   (j + nearest[jj] >= 0) && 
                   (j + nearest[jj] <= sizeX - 1))
               {
-                (*map)->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2    ]             ] += 
+                map->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2    ]             ] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 + 1];
-                (*map)->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+                map->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 + 1];
               }
             }
@@ -258,6 +348,63 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
         }/*for(ii = 0; ii < k; ii++)*/
       }/*for(j = 1; j < sizeX - 1; j++)*/
     }/*for(i = 1; i < sizeY - 1; i++)*/
+}
+
+/*
+// Getting feature map for the selected subimage
+//
+// API
+// int getFeatureMaps(const IplImage * image, const int k, featureMap **map);
+// INPUT
+// image             - selected subimage
+// k                 - size of cells
+// OUTPUT
+// map               - feature map
+// RESULT
+// Error status
+*/
+int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade **map)
+{
+    int sizeX, sizeY;
+    int p, px;
+    int height, width;
+    
+    IplImage * dx, * dy;
+    int *nearest;
+    float *w;
+
+    float kernel[3] = {-1.f, 0.f, 1.f};
+    CvMat kernel_dx = cvMat(1, 3, CV_32F, kernel);
+    CvMat kernel_dy = cvMat(3, 1, CV_32F, kernel);
+
+    float * r;
+    int   * alfa;
+
+    height = image->height;
+    width  = image->width ;
+
+    dx    = cvCreateImage(cvSize(image->width, image->height), IPL_DEPTH_32F, image->nChannels);
+    dy    = cvCreateImage(cvSize(image->width, image->height), IPL_DEPTH_32F, image->nChannels);
+
+    sizeX = width  / k;
+    sizeY = height / k;
+    px    = 3 * NUM_SECTOR; 
+    p     = px;
+    allocFeatureMapObject(map, sizeX, sizeY, p);
+
+    cvFilter2D(image, dx, &kernel_dx, cvPoint(-1, 0));
+    cvFilter2D(image, dy, &kernel_dy, cvPoint(0, -1));
+
+    r    = (float *)malloc( sizeof(float) * (width * height));
+    alfa = (int   *)malloc( sizeof(int  ) * (width * height * 2));
+
+    gradientBins(dx, dy, r, alfa);
+
+    nearest = (int  *)malloc(sizeof(int  ) *  k);
+    w       = (float*)malloc(sizeof(float) * (k * 2));
+
+    cellWeights(k, nearest, w);
+    cellHistograms(r, alfa, width, height, k, nearest, w, *map);
     
     cvReleaseImage(&dx);
     cvReleaseImage(&dy);
@@ -272,6 +419,66 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
     return LATENT_SVM_OK;
 }
 
+/*
+// Getting feature map for the selected subimage, reusing the buffers of a workspace
+//
+// API
+// int getFeatureMapsWs(const IplImage * image, const int k, CvLSVMFeatureWorkspace *ws);
+// INPUT
+// image             - selected subimage
+// k                 - size of cells
+// ws                - workspace
+// OUTPUT
+// ws->map           - feature map, owned by the workspace
+// RESULT
+// Error status
+*/
+int getFeatureMapsWs(const IplImage* image, const int k, CvLSVMFeatureWorkspace *ws)
+{
+    int sizeX, sizeY, p;
+    int height, width, numChannels;
+    IplImage dx, dy;
+
+    float kernel[3] = {-1.f, 0.f, 1.f};
+    CvMat kernel_dx = cvMat(1, 3, CV_32F, kernel);
+    CvMat kernel_dy = cvMat(3, 1, CV_32F, kernel);
+
+    height = image->height;
+    width  = image->width ;
+    numChannels = image->nChannels;
+
+    sizeX = width  / k;
+    sizeY = height / k;
+    p     = 3 * NUM_SECTOR;
+
+    int gradSize = sizeof(float) * width * height * numChannels;
+    ws->dx   = (float *)reserveBuffer(ws->dx, &ws->dxCapacity, gradSize, &ws->allocations);
+    ws->dy   = (float *)reserveBuffer(ws->dy, &ws->dyCapacity, gradSize, &ws->allocations);
+    ws->r    = (float *)reserveBuffer(ws->r, &ws->rCapacity, sizeof(float) * width * height, &ws->allocations);
+    ws->alfa = (int   *)reserveBuffer(ws->alfa, &ws->alfaCapacity, sizeof(int) * width * height * 2, &ws->allocations);
+    ws->nearest = (int *)reserveBuffer(ws->nearest, &ws->nearestCapacity, sizeof(int) * k, &ws->allocations);
+    ws->w    = (float *)reserveBuffer(ws->w, &ws->wCapacity, sizeof(float) * k * 2, &ws->allocations);
+    ws->map.map = (float *)reserveBuffer(ws->map.map, &ws->mapCapacity, sizeof(float) * sizeX * sizeY * p, &ws->allocations);
+
+    ws->map.sizeX = sizeX;
+    ws->map.sizeY = sizeY;
+    ws->map.numFeatures = p;
+    memset(ws->map.map, 0, sizeof(float) * sizeX * sizeY * p);
+
+    cvInitImageHeader(&dx, cvSize(width, height), IPL_DEPTH_32F, numChannels);
+    cvInitImageHeader(&dy, cvSize(width, height), IPL_DEPTH_32F, numChannels);
+    cvSetData(&dx, ws->dx, sizeof(float) * width * numChannels);
+    cvSetData(&dy, ws->dy, sizeof(float) * width * numChannels);
+
+    cvFilter2D(image, &dx, &kernel_dx, cvPoint(-1, 0));
+    cvFilter2D(image, &dy, &kernel_dy, cvPoint(0, -1));
+
+    gradientBins(&dx, &dy, ws->r, ws->alfa);
+    cellWeights(k, ws->nearest, ws->w);
+    cellHistograms(ws->r, ws->alfa, width, height, k, ws->nearest, ws->w, &ws->map);
+
+    return LATENT_SVM_OK;
+}
 
 
 void calcDxDy(const IplImage* image, IplImage* dx, IplImage* dy)
@@ -478,30 +685,16 @@ int calcFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade
     return LATENT_SVM_OK;                      
 }
 
-/*
-// Feature map Normalization and Truncation 
-//
-// API
-// int normalizeAndTruncate(featureMap *map, const float alfa);
-// INPUT
-// map               - feature map
-// alfa              - truncation threshold
-// OUTPUT
-// map               - truncated and normalized feature map
-// RESULT
-// Error status
-*/
-int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
+// Block normalization and truncation of map into newData ((sizeX - 2) * (sizeY - 2) * 4 * 3 * NUM_SECTOR floats).
+// partOfNorm is scratch space for sizeX * sizeY floats.
+static void normalizeAndTruncateCore(const CvLSVMFeatureMapCaskade *map, float *partOfNorm, float *newData, const float alfa)
 {
     int i,j, ii;
     int sizeX, sizeY, p, pos, pp, xp, pos1, pos2;
-    float * partOfNorm; // norm of C(i, j)
-    float * newData;
     float   valOfNorm;
 
     sizeX     = map->sizeX;
     sizeY     = map->sizeY;
-    partOfNorm = (float *)malloc (sizeof(float) * (sizeX * sizeY));
 
     p  = NUM_SECTOR;
     xp = NUM_SECTOR * 3;
@@ -521,7 +714,6 @@ int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
     sizeX -= 2;
     sizeY -= 2;
 
-    newData = (float *)malloc (sizeof(float) * (sizeX * sizeY * pp));
 //normalization
     for(i = 1; i <= sizeY; i++)
     {
@@ -588,11 +780,39 @@ int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
     {
         if(newData [i] > alfa) newData [i] = alfa;
     }/*for(i = 0; i < sizeX * sizeY * pp; i++)*/
+}
+
+/*
+// Feature map Normalization and Truncation 
+//
+// API
+// int normalizeAndTruncate(featureMap *map, const float alfa);
+// INPUT
+// map               - feature map
+// alfa              - truncation threshold
+// OUTPUT
+// map               - truncated and normalized feature map
+// RESULT
+// Error status
+*/
+int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
+{
+    int sizeX, sizeY, pp;
+    float * partOfNorm; // norm of C(i, j)
+    float * newData;
+
+    sizeX     = map->sizeX;
+    sizeY     = map->sizeY;
+    pp        = NUM_SECTOR * 12;
+    partOfNorm = (float *)malloc (sizeof(float) * (sizeX * sizeY));
+    newData = (float *)malloc (sizeof(float) * ((sizeX - 2) * (sizeY - 2) * pp));
+
+    normalizeAndTruncateCore(map, partOfNorm, newData, alfa);
 //swop data
 
     map->numFeatures  = pp;
-    map->sizeX = sizeX;
-    map->sizeY = sizeY;
+    map->sizeX = sizeX - 2;
+    map->sizeY = sizeY - 2;
 
     free (map->map);
     free (partOfNorm);
@@ -601,25 +821,54 @@ int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
 
     return LATENT_SVM_OK;
 }
+
 /*
-// Feature map reduction
-// In each cell we reduce dimension of the feature vector
-// according to original paper special procedure
+// Feature map Normalization and Truncation of the workspace map, without allocations in steady state
 //
 // API
-// int PCAFeatureMaps(featureMap *map)
+// int normalizeAndTruncateWs(CvLSVMFeatureWorkspace *ws, const float alfa);
 // INPUT
-// map               - feature map
+// ws                - workspace holding the feature map
+// alfa              - truncation threshold
 // OUTPUT
-// map               - feature map
+// ws->map           - truncated and normalized feature map
 // RESULT
 // Error status
 */
-int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
+int normalizeAndTruncateWs(CvLSVMFeatureWorkspace *ws, const float alfa)
+{
+    CvLSVMFeatureMapCaskade *map = &ws->map;
+    int sizeX = map->sizeX;
+    int sizeY = map->sizeY;
+    int pp    = NUM_SECTOR * 12;
+    float *data;
+    int capacity;
+
+    ws->partOfNorm = (float *)reserveBuffer(ws->partOfNorm, &ws->partOfNormCapacity, sizeof(float) * sizeX * sizeY, &ws->allocations);
+    ws->spare = (float *)reserveBuffer(ws->spare, &ws->spareCapacity, sizeof(float) * (sizeX - 2) * (sizeY - 2) * pp, &ws->allocations);
+
+    normalizeAndTruncateCore(map, ws->partOfNorm, ws->spare, alfa);
+//swop data
+
+    map->numFeatures  = pp;
+    map->sizeX = sizeX - 2;
+    map->sizeY = sizeY - 2;
+
+    data = map->map;
+    capacity = ws->mapCapacity;
+    map->map = ws->spare;
+    ws->mapCapacity = ws->spareCapacity;
+    ws->spare = data;
+    ws->spareCapacity = capacity;
+
+    return LATENT_SVM_OK;
+}
+
+// Analytic projection of the 4 * 3 * NUM_SECTOR features of every cell to 3 * NUM_SECTOR + 4, into newData
+static void PCAFeatureMapsCore(const CvLSVMFeatureMapCaskade *map, float *newData)
 { 
     int i,j, ii, jj, k;
     int sizeX, sizeY, p,  pp, xp, yp, pos1, pos2;
-    float * newData;
     float val;
     float nx, ny;
     
@@ -633,8 +882,6 @@ int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
     nx    = 1.0f / sqrtf((float)(xp * 2));
     ny    = 1.0f / sqrtf((float)(yp    ));
 
-    newData = (float *)malloc (sizeof(float) * (sizeX * sizeY * pp));
-
     for(i = 0; i < sizeY; i++)
     {
         for(j = 0; j < sizeX; j++)
@@ -674,6 +921,30 @@ int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
             } /*for(ii = 0; ii < yp; ii++)*/           
         }/*for(j = 0; j < sizeX; j++)*/
     }/*for(i = 0; i < sizeY; i++)*/
+}
+
+/*
+// Feature map reduction
+// In each cell we reduce dimension of the feature vector
+// according to original paper special procedure
+//
+// API
+// int PCAFeatureMaps(featureMap *map)
+// INPUT
+// map               - feature map
+// OUTPUT
+// map               - feature map
+// RESULT
+// Error status
+*/
+int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
+{ 
+    int pp = NUM_SECTOR * 3 + 4;
+    float * newData;
+
+    newData = (float *)malloc (sizeof(float) * (map->sizeX * map->sizeY * pp));
+
+    PCAFeatureMapsCore(map, newData);
 //swop data
 
     map->numFeatures = pp;
@@ -685,6 +956,200 @@ int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
     return LATENT_SVM_OK;
 }
 
+/*
+// Feature map reduction of the workspace map, without allocations in steady state
+//
+// API
+// int PCAFeatureMapsWs(CvLSVMFeatureWorkspace *ws)
+// INPUT
+// ws                - workspace holding the feature map
+// OUTPUT
+// ws->map           - feature map
+// RESULT
+// Error status
+*/
+int PCAFeatureMapsWs(CvLSVMFeatureWorkspace *ws)
+{
+    CvLSVMFeatureMapCaskade *map = &ws->map;
+    int pp = NUM_SECTOR * 3 + 4;
+    float *data;
+    int capacity;
+
+    ws->spare = (float *)reserveBuffer(ws->spare, &ws->spareCapacity, sizeof(float) * map->sizeX * map->sizeY * pp, &ws->allocations);
+
+    PCAFeatureMapsCore(map, ws->spare);
+//swop data
+
+    map->numFeatures = pp;
+
+    data = map->map;
+    capacity = ws->mapCapacity;
+    map->map = ws->spare;
+    ws->mapCapacity = ws->spareCapacity;
+    ws->spare = data;
+    ws->spareCapacity = capacity;
+
+    return LATENT_SVM_OK;
+}
+
+// normalizeAndTruncateCore followed by PCAFeatureMapsCore, one cell at a time. Every value is computed
+// with the same operations in the same order, so the results are identical. partOfNorm is scratch
+// space for sizeX * sizeY floats, dst gets the reduced map (planar or cell-major, see the header).
+static void normalizeAndPCACore(const CvLSVMFeatureMapCaskade *map, float *partOfNorm, float *dst,
+                                const float alfa, const int planar)
+{
+    int i, j, ii, jj, k, q;
+    int width, height, cells, p, xp, yp, pp, pos, pos1, cell;
+    float valOfNorm, val, nx, ny;
+    float norms[4];
+    float cellData[NUM_SECTOR * 12]; // normalized and truncated features of the current cell
+    float reduced[NUM_SECTOR * 3 + 4];
+    const float *src;
+
+    width  = map->sizeX;
+    height = map->sizeY;
+    cells  = (width - 2) * (height - 2);
+    p      = NUM_SECTOR;
+    xp     = NUM_SECTOR * 3;
+    yp     = 4;
+    pp     = NUM_SECTOR * 3 + 4;
+
+    nx    = 1.0f / sqrtf((float)(p * 2));
+    ny    = 1.0f / sqrtf((float)(yp   ));
+
+    for(i = 0; i < width * height; i++)
+    {
+        valOfNorm = 0.0f;
+        pos = i * map->numFeatures;
+        for(j = 0; j < p; j++)
+        {
+            valOfNorm += map->map[pos + j] * map->map[pos + j];
+        }/*for(j = 0; j < p; j++)*/
+        partOfNorm[i] = valOfNorm;
+    }/*for(i = 0; i < width * height; i++)*/
+
+    for(i = 1; i < height - 1; i++)
+    {
+        for(j = 1; j < width - 1; j++)
+        {
+            // Norms of the 4 blocks around the cell
+            norms[0] = sqrtf(
+                partOfNorm[(i    )*width + (j    )] +
+                partOfNorm[(i    )*width + (j + 1)] +
+                partOfNorm[(i + 1)*width + (j    )] +
+                partOfNorm[(i + 1)*width + (j + 1)]) + FLT_EPSILON;
+            norms[1] = sqrtf(
+                partOfNorm[(i    )*width + (j    )] +
+                partOfNorm[(i    )*width + (j + 1)] +
+                partOfNorm[(i - 1)*width + (j    )] +
+                partOfNorm[(i - 1)*width + (j + 1)]) + FLT_EPSILON;
+            norms[2] = sqrtf(
+                partOfNorm[(i    )*width + (j    )] +
+                partOfNorm[(i    )*width + (j - 1)] +
+                partOfNorm[(i + 1)*width + (j    )] +
+                partOfNorm[(i + 1)*width + (j - 1)]) + FLT_EPSILON;
+            norms[3] = sqrtf(
+                partOfNorm[(i    )*width + (j    )] +
+                partOfNorm[(i    )*width + (j - 1)] +
+                partOfNorm[(i - 1)*width + (j    )] +
+                partOfNorm[(i - 1)*width + (j - 1)]) + FLT_EPSILON;
+
+            // Normalization and truncation
+            pos1 = (i * width + j) * xp;
+            src = map->map + pos1;
+            for(q = 0; q < 4; q++)
+            {
+                for(ii = 0; ii < p; ii++)
+                {
+                    val = src[ii] / norms[q];
+                    cellData[ii + p * q] = val > alfa ? alfa : val;
+                }/*for(ii = 0; ii < p; ii++)*/
+                for(ii = 0; ii < 2 * p; ii++)
+                {
+                    val = src[ii + p] / norms[q];
+                    cellData[ii + p * 4 + p * 2 * q] = val > alfa ? alfa : val;
+                }/*for(ii = 0; ii < 2 * p; ii++)*/
+            }/*for(q = 0; q < 4; q++)*/
+
+            // Reduction
+            k = 0;
+            for(jj = 0; jj < p * 2; jj++)
+            {
+                val = 0;
+                for(ii = 0; ii < yp; ii++)
+                {
+                    val += cellData[yp * p + ii * p * 2 + jj];
+                }/*for(ii = 0; ii < yp; ii++)*/
+                reduced[k++] = val * ny;
+            }/*for(jj = 0; jj < p * 2; jj++)*/
+            for(jj = 0; jj < p; jj++)
+            {
+                val = 0;
+                for(ii = 0; ii < yp; ii++)
+                {
+                    val += cellData[ii * p + jj];
+                }/*for(ii = 0; ii < yp; ii++)*/
+                reduced[k++] = val * ny;
+            }/*for(jj = 0; jj < p; jj++)*/
+            for(ii = 0; ii < yp; ii++)
+            {
+                val = 0;
+                for(jj = 0; jj < 2 * p; jj++)
+                {
+                    val += cellData[yp * p + ii * p * 2 + jj];
+                }/*for(jj = 0; jj < 2 * p; jj++)*/
+                reduced[k++] = val * nx;
+            }/*for(ii = 0; ii < yp; ii++)*/
+
+            cell = (i - 1) * (width - 2) + (j - 1);
+            if (planar)
+            {
+                for(k = 0; k < pp; k++)
+                    dst[k * cells + cell] = reduced[k];
+            }
+            else
+            {
+                memcpy(dst + cell * pp, reduced, sizeof(float) * pp);
+            }
+        }/*for(j = 1; j < width - 1; j++)*/
+    }/*for(i = 1; i < height - 1; i++)*/
+}
+
+int normalizeAndPCAFeatureMapsWs(CvLSVMFeatureWorkspace *ws, const float alfa,
+                                 float *dst, const int planar)
+{
+    CvLSVMFeatureMapCaskade *map = &ws->map;
+    int sizeX = map->sizeX;
+    int sizeY = map->sizeY;
+    int pp    = NUM_SECTOR * 3 + 4;
+    float *data;
+    int capacity;
+
+    ws->partOfNorm = (float *)reserveBuffer(ws->partOfNorm, &ws->partOfNormCapacity, sizeof(float) * sizeX * sizeY, &ws->allocations);
+    if (dst)
+    {
+        normalizeAndPCACore(map, ws->partOfNorm, dst, alfa, planar);
+        return LATENT_SVM_OK;
+    }
+
+    ws->spare = (float *)reserveBuffer(ws->spare, &ws->spareCapacity, sizeof(float) * (sizeX - 2) * (sizeY - 2) * pp, &ws->allocations);
+    normalizeAndPCACore(map, ws->partOfNorm, ws->spare, alfa, planar);
+//swop data
+
+    map->numFeatures = pp;
+    map->sizeX = sizeX - 2;
+    map->sizeY = sizeY - 2;
+
+    data = map->map;
+    capacity = ws->mapCapacity;
+    map->map = ws->spare;
+    ws->mapCapacity = ws->spareCapacity;
+    ws->spare = data;
+    ws->spareCapacity = capacity;
+
+    return LATENT_SVM_OK;
+}
+
 
 //modified from "lsvmc_routine.cpp"
 
@@ -716,6 +1181,30 @@ int freeFeatureMapObject (CvLSVMFeatureMapCaskade **obj)
     return LATENT_SVM_OK;
 }
 
+int allocFeatureWorkspace(CvLSVMFeatureWorkspace **ws)
+{
+    (*ws) = (CvLSVMFeatureWorkspace *)calloc(1, sizeof(CvLSVMFeatureWorkspace));
+    return LATENT_SVM_OK;
+}
+
+int freeFeatureWorkspace(CvLSVMFeatureWorkspace **ws)
+{
+    if(*ws == NULL) return LATENT_SVM_MEM_NULL;
+
+    free((*ws)->map.map);
+    free((*ws)->spare);
+    free((*ws)->dx);
+    free((*ws)->dy);
+    free((*ws)->r);
+    free((*ws)->alfa);
+    free((*ws)->nearest);
+    free((*ws)->w);
+    free((*ws)->partOfNorm);
+    free(*ws);
+    (*ws) = NULL;
+    return LATENT_SVM_OK;
+}
+
 
 void log_featuremap(CvLSVMFeatureMapCaskade* map)
 {
@@ -724,9 +1213,9 @@ void log_featuremap(CvLSVMFeatureMapCaskade* map)
 
 int compare_featuremap(CvLSVMFeatureMapCaskade* map0, CvLSVMFeatureMapCaskade* map1)
 {
-    printf("featuremap0(%d %d %d)\n", map0->sizeX, map0->sizeY, map0->numFeatures);
-    printf("featuremap1(%d %d %d)\n", map1->sizeX, map1->sizeY, map1->numFeatures);
     if ((map0->sizeX != map1->sizeX) || (map0->sizeY != map1->sizeY) || (map0->numFeatures != map1->numFeatures)) {
+        printf("featuremap0(%d %d %d)\n", map0->sizeX, map0->sizeY, map0->numFeatures);
+        printf("featuremap1(%d %d %d)\n", map1->sizeX, map1->sizeY, map1->numFeatures);
         return -1;
     }
 
@@ -740,4 +1229,5 @@ int compare_featuremap(CvLSVMFeatureMapCaskade* map0, CvLSVMFeatureMapCaskade* m
         if (errcnt > 10)
             break;
     }
+    return errcnt > 0 ? -1 : 0;
 }
\ No newline at end of file
@@ -76,6 +76,34 @@ typedef struct{
     float *map;
 } CvLSVMFeatureMapCaskade;
 
+// DataType: STRUCT CvLSVMFeatureWorkspace
+// Feature map together with all scratch buffers of its computation.
+// Buffers only grow (capacities in bytes), so repeated computations of the
+// same or smaller size perform no heap allocations.
+//   map             - feature map, map.map is owned by the workspace
+//   allocations     - number of buffer allocations performed so far
+typedef struct CvLSVMFeatureWorkspace{
+    CvLSVMFeatureMapCaskade map;
+    int mapCapacity;
+    float *spare;
+    int spareCapacity;
+    float *dx;
+    int dxCapacity;
+    float *dy;
+    int dyCapacity;
+    float *r;
+    int rCapacity;
+    int *alfa;
+    int alfaCapacity;
+    int *nearest;
+    int nearestCapacity;
+    float *w;
+    int wCapacity;
+    float *partOfNorm;
+    int partOfNormCapacity;
+    int allocations;
+} CvLSVMFeatureWorkspace;
+
 
 #include "float.h"
 
@@ -135,6 +163,22 @@ typedef struct{
 int getFeatureMaps(const IplImage * image, const int k, CvLSVMFeatureMapCaskade **map);
 int calcFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade **map);
 
+/*
+// Getting feature map for the selected subimage, reusing the buffers of a workspace
+//
+// API
+// int getFeatureMapsWs(const IplImage * image, const int k, CvLSVMFeatureWorkspace *ws);
+// INPUT
+// image             - selected subimage
+// k                 - size of cells
+// ws                - workspace
+// OUTPUT
+// ws->map           - feature map
+// RESULT
+// Error status
+*/
+int getFeatureMapsWs(const IplImage * image, const int k, CvLSVMFeatureWorkspace *ws);
+
 /*
 // Feature map Normalization and Truncation 
 //
@@ -149,6 +193,7 @@ int calcFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade
 // Error status
 */
 int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa);
+int normalizeAndTruncateWs(CvLSVMFeatureWorkspace *ws, const float alfa);
 
 /*
 // Feature map reduction
@@ -165,6 +210,29 @@ int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa);
 // Error status
 */
 int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map);
+int PCAFeatureMapsWs(CvLSVMFeatureWorkspace *ws);
+
+/*
+// normalizeAndTruncate followed by PCAFeatureMaps in one pass over the cells,
+// with the same results
+//
+// API
+// int normalizeAndPCAFeatureMapsWs(CvLSVMFeatureWorkspace *ws, const float alfa,
+                                    float *dst, const int planar);
+// INPUT
+// ws                - workspace holding the feature map from getFeatureMapsWs
+// alfa              - truncation threshold
+// dst               - output buffer of (sizeX - 2) * (sizeY - 2) * (3 * NUM_SECTOR + 4) floats,
+//                     NULL to put the result into ws->map
+// planar            - if nonzero dst is channel-major, one plane of (sizeX - 2) * (sizeY - 2)
+//                     floats per feature, otherwise it has the cell-major layout of the maps
+// OUTPUT
+// dst or ws->map    - reduced feature map; ws->map is left unchanged when writing into dst
+// RESULT
+// Error status
+*/
+int normalizeAndPCAFeatureMapsWs(CvLSVMFeatureWorkspace *ws, const float alfa,
+                                 float *dst, const int planar);
 
 
 //modified from "lsvmc_routine.h"
@@ -174,6 +242,10 @@ int allocFeatureMapObject(CvLSVMFeatureMapCaskade **obj, const int sizeX, const
 
 int freeFeatureMapObject (CvLSVMFeatureMapCaskade **obj);
 
+int allocFeatureWorkspace(CvLSVMFeatureWorkspace **ws);
+
+int freeFeatureWorkspace(CvLSVMFeatureWorkspace **ws);
+
 void log_featuremap(CvLSVMFeatureMapCaskade* map);
 int compare_featuremap(CvLSVMFeatureMapCaskade* map0, CvLSVMFeatureMapCaskade* map1);
 
@@ -0,0 +1,69 @@
+// AVX2 kernel of the FHOG gradient binning. This file alone is compiled with -mavx2 (see
+// CMakeLists.txt), fhog.cpp calls it only when the CPU supports AVX2. It does the operations of
+// gradientBinPixel in the same order, without fused multiply-adds.
+
+#include "fhog.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+// gradientBinPixel for 8 consecutive pixels
+static inline void gradientBinBlock(const float *dx, const float *dy, int numChannels,
+                                    const float *boundary_x, const float *boundary_y, float *r, int *alfa)
+{
+    __m256 x, y, best;
+    __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(numChannels));
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    int ch, kk;
+
+    if (numChannels == 1) {
+        x = _mm256_loadu_ps(dx);
+        y = _mm256_loadu_ps(dy);
+    } else {
+        x = _mm256_i32gather_ps(dx, stride, 4);
+        y = _mm256_i32gather_ps(dy, stride, 4);
+    }
+    best = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+    for (ch = 1; ch < numChannels; ch++) {
+        __m256 tx = _mm256_i32gather_ps(dx + ch, stride, 4);
+        __m256 ty = _mm256_i32gather_ps(dy + ch, stride, 4);
+        __m256 magnitude = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty)));
+        __m256 stronger = _mm256_cmp_ps(magnitude, best, _CMP_GT_OQ);
+        best = _mm256_blendv_ps(best, magnitude, stronger);
+        x = _mm256_blendv_ps(x, tx, stronger);
+        y = _mm256_blendv_ps(y, ty, stronger);
+    }
+    _mm256_storeu_ps(r, best);
+
+    __m256 max = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(boundary_x[0]), x),
+                               _mm256_mul_ps(_mm256_set1_ps(boundary_y[0]), y));
+    __m256 maxi = _mm256_castsi256_ps(_mm256_setzero_si256());
+    for (kk = 0; kk < NUM_SECTOR; kk++) {
+        __m256 dotProd = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(boundary_x[kk]), x),
+                                       _mm256_mul_ps(_mm256_set1_ps(boundary_y[kk]), y));
+        __m256 negProd = _mm256_xor_ps(dotProd, sign);
+        __m256 above = _mm256_cmp_ps(dotProd, max, _CMP_GT_OQ);
+        __m256 below = _mm256_andnot_ps(above, _mm256_cmp_ps(negProd, max, _CMP_GT_OQ));
+        max = _mm256_blendv_ps(_mm256_blendv_ps(max, dotProd, above), negProd, below);
+        maxi = _mm256_blendv_ps(maxi, _mm256_castsi256_ps(_mm256_set1_epi32(kk)), above);
+        maxi = _mm256_blendv_ps(maxi, _mm256_castsi256_ps(_mm256_set1_epi32(kk + NUM_SECTOR)), below);
+    }
+
+    int bins[8];
+    _mm256_storeu_si256((__m256i *) bins, _mm256_castps_si256(maxi));
+    for (kk = 0; kk < 8; kk++) {
+        alfa[kk * 2    ] = bins[kk] % NUM_SECTOR;
+        alfa[kk * 2 + 1] = bins[kk];
+    }
+}
+
+int gradientBinsAVX2(const float *dx, const float *dy, int numChannels,
+                     const float *boundary_x, const float *boundary_y, float *r, int *alfa, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        gradientBinBlock(dx + i * numChannels, dy + i * numChannels, numChannels,
+                         boundary_x, boundary_y, r + i, alfa + i * 2);
+    return i;
+}
+#endif
@@ -0,0 +1,72 @@
+#include "frameview.hpp"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <string.h>
+
+// A size x type matrix in storage, which only grows
+static cv::Mat reserve(cv::Mat &storage, const cv::Size &size, int type)
+{
+    size_t bytes = (size_t) size.width * size.height * CV_ELEM_SIZE(type);
+    if (storage.total() * storage.elemSize() < bytes)
+        storage.create(1, (int) bytes, CV_8U);
+    return cv::Mat(size, type, storage.data);
+}
+
+void FrameView::toBGR(cv::Mat &bgr, cv::Mat &buffer) const
+{
+    if (format == BGR) {
+        bgr = mat();
+        return;
+    }
+    if (format == GRAY) {
+        cv::cvtColor(mat(), bgr, cv::COLOR_GRAY2BGR);
+        return;
+    }
+
+    // cvtColor takes NV12 as one matrix, the Y rows followed by the UV rows with the same stride
+    cv::Mat yuv;
+    if (uv == data + height * step && uv_step == step) {
+        yuv = cv::Mat(height * 3 / 2, width, CV_8UC1, (void *) data, step);
+    }
+    else {
+        buffer.create(height * 3 / 2, width, CV_8UC1);
+        for (int y = 0; y < height; y++)
+            memcpy(buffer.ptr(y), data + y * step, width);
+        for (int y = 0; y < height / 2; y++)
+            memcpy(buffer.ptr(height + y), uv + y * uv_step, width);
+        yuv = buffer;
+    }
+    cv::cvtColor(yuv, bgr, cv::COLOR_YUV2BGR_NV12);
+}
+
+cv::Rect FrameView::toBGR(const cv::Rect &region, cv::Mat &bgr, cv::Mat &storage, cv::Mat &buffer) const
+{
+    // At least one pixel, the nearest one for a region outside of the frame
+    int align = format == NV12 ? 2 : 1;
+    int x0 = std::min(std::max(region.x, 0), width - 1) / align * align;
+    int y0 = std::min(std::max(region.y, 0), height - 1) / align * align;
+    int x1 = std::max(std::min(region.x + region.width, width), x0 + 1);
+    int y1 = std::max(std::min(region.y + region.height, height), y0 + 1);
+    x1 = std::min((x1 + align - 1) / align * align, width);
+    y1 = std::min((y1 + align - 1) / align * align, height);
+    cv::Rect r(x0, y0, x1 - x0, y1 - y0);
+
+    if (format == BGR) {
+        bgr = mat()(r);
+        return r;
+    }
+    bgr = reserve(storage, r.size(), CV_8UC3);
+    if (format == GRAY) {
+        cv::cvtColor(mat()(r), bgr, cv::COLOR_GRAY2BGR);
+        return r;
+    }
+
+    // The Y rows of the region followed by its UV rows, the UV pairs start at the even x0
+    cv::Mat yuv = reserve(buffer, cv::Size(r.width, r.height * 3 / 2), CV_8UC1);
+    for (int y = 0; y < r.height; y++)
+        memcpy(yuv.ptr(y), data + (y0 + y) * step + x0, r.width);
+    for (int y = 0; y < r.height / 2; y++)
+        memcpy(yuv.ptr(r.height + y), uv + (y0 / 2 + y) * uv_step + x0, r.width);
+    cv::cvtColor(yuv, bgr, cv::COLOR_YUV2BGR_NV12);
+    return r;
+}
@@ -0,0 +1,61 @@
+/*
+Borrowed view of a frame owned by the caller, e.g. the output buffer of a hardware decoder.
+
+The view only points to the pixels, nothing is copied when it is created or handed to a tracker.
+The pixels must stay valid and unchanged for the duration of the init() or update() call given
+the view. Supported layouts:
+    GRAY: 8 bit, one plane
+    BGR:  8 bit interleaved, one plane
+    NV12: the 8 bit Y plane followed by a half resolution plane of interleaved U, V samples;
+          the planes may be apart and have their own strides
+*/
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+struct FrameView
+{
+    enum Format { GRAY, BGR, NV12 };
+
+    Format format;
+    int width, height;
+    const uchar *data; // pixels, the Y plane for NV12
+    size_t step;       // bytes from one row of data to the next
+    const uchar *uv;   // NV12 only: the UV plane, height / 2 rows
+    size_t uv_step;
+
+    static FrameView gray(const uchar *data, int width, int height, size_t step)
+    {
+        FrameView view = { GRAY, width, height, data, step, NULL, 0 };
+        return view;
+    }
+
+    static FrameView bgr(const uchar *data, int width, int height, size_t step)
+    {
+        FrameView view = { BGR, width, height, data, step, NULL, 0 };
+        return view;
+    }
+
+    static FrameView nv12(const uchar *y, size_t y_step, const uchar *uv, size_t uv_step, int width, int height)
+    {
+        FrameView view = { NV12, width, height, y, y_step, uv, uv_step };
+        return view;
+    }
+
+    // Header over the pixels without a copy: the image for GRAY and BGR, the Y plane (luma as gray) for NV12
+    cv::Mat mat() const
+    {
+        return cv::Mat(height, width, format == BGR ? CV_8UC3 : CV_8UC1, (void *) data, step);
+    }
+
+    // The frame as a BGR image. BGR views are wrapped without a copy, the other formats are converted
+    // into bgr. NV12 planes that are not contiguous are gathered into buffer first. Both are reused
+    // while the frame size does not change.
+    void toBGR(cv::Mat &bgr, cv::Mat &buffer) const;
+
+    // Only region of the frame as a BGR image. The region is clipped to the frame, and extended to even
+    // coordinates for NV12, which shares a UV sample between 2 x 2 pixels; the returned rectangle is
+    // the part of the frame in bgr. bgr is a view of storage, storage and buffer only grow.
+    cv::Rect toBGR(const cv::Rect &region, cv::Mat &bgr, cv::Mat &storage, cv::Mat &buffer) const;
+};
@@ -0,0 +1,84 @@
+#include "halffloat.hpp"
+#include <assert.h>
+
+#if defined(__AVX__) && defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+void HalfFloat::fromFloat(const float *src, short *dst, int n)
+{
+    int i = 0;
+#if defined(__AVX__) && defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *) (dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4)
+        vst1_s16(dst + i, vreinterpret_s16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+#endif
+    for (; i < n; i++)
+        dst[i] = fromFloat(src[i]);
+}
+
+void HalfFloat::toFloat(const short *src, float *dst, int n)
+{
+    int i = 0;
+#if defined(__AVX__) && defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (src + i))));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_s16(vld1_s16(src + i))));
+#endif
+    for (; i < n; i++)
+        dst[i] = toFloat(src[i]);
+}
+
+void HalfFloat::addWeighted(short *dst, float alpha, const float *src, float beta, int n)
+{
+    int i = 0;
+#if defined(__AVX__) && defined(__F16C__)
+    __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (dst + i)));
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(va, d), _mm256_mul_ps(vb, _mm256_loadu_ps(src + i)));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t va = vdupq_n_f32(alpha), vb = vdupq_n_f32(beta);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t d = vcvt_f32_f16(vreinterpret_f16_s16(vld1_s16(dst + i)));
+        float32x4_t v = vaddq_f32(vmulq_f32(va, d), vmulq_f32(vb, vld1q_f32(src + i)));
+        vst1_s16(dst + i, vreinterpret_s16_f16(vcvt_f16_f32(v)));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = fromFloat(alpha * toFloat(dst[i]) + beta * src[i]);
+}
+
+void HalfFloat::fromFloat(const cv::Mat &src, cv::Mat &dst)
+{
+    assert(src.depth() == CV_32F);
+    dst.create(src.size(), CV_MAKETYPE(CV_16S, src.channels()));
+    int n = src.cols * src.channels();
+    for (int i = 0; i < src.rows; i++)
+        fromFloat(src.ptr<float>(i), dst.ptr<short>(i), n);
+}
+
+void HalfFloat::toFloat(const cv::Mat &src, cv::Mat &dst)
+{
+    assert(src.depth() == CV_16S);
+    dst.create(src.size(), CV_MAKETYPE(CV_32F, src.channels()));
+    int n = src.cols * src.channels();
+    for (int i = 0; i < src.rows; i++)
+        toFloat(src.ptr<short>(i), dst.ptr<float>(i), n);
+}
+
+void HalfFloat::addWeighted(cv::Mat &dst, float alpha, const cv::Mat &src, float beta)
+{
+    assert(dst.depth() == CV_16S && src.depth() == CV_32F && dst.size() == src.size() && dst.channels() == src.channels());
+    int n = src.cols * src.channels();
+    for (int i = 0; i < src.rows; i++)
+        addWeighted(dst.ptr<short>(i), alpha, src.ptr<float>(i), beta, n);
+}
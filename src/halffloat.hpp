@@ -0,0 +1,96 @@
+/*
+IEEE 754 half precision storage of float data.
+
+The halves are kept in 16 bit signed matrices (CV_16S, with the channels of the float data),
+like cv::convertFp16 does in OpenCV 3. Conversions round to the nearest even half, and keep
+infinities and NaNs. The array functions use F16C with AVX, or the NEON conversions on
+AArch64, where available; the scalar versions give the same results, except that they make
+every NaN the quiet NaN 0x7e00 (with its sign) instead of keeping the payload.
+*/
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+#include <string.h>
+
+namespace HalfFloat
+{
+inline short fromFloat(float value)
+{
+    uint32_t x;
+    memcpy(&x, &value, 4);
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint32_t h;
+    if (x >= (127 + 16) << 23) {
+        // Too large, infinity or NaN
+        h = x > 255u << 23 ? 0x7e00 : 0x7c00;
+    }
+    else if (x < 113u << 23) {
+        // Subnormal halves: the float addition does the rounding
+        const uint32_t magic_bits = ((127 - 15) + (23 - 10) + 1) << 23;
+        float f, magic;
+        memcpy(&f, &x, 4);
+        memcpy(&magic, &magic_bits, 4);
+        f += magic;
+        memcpy(&h, &f, 4);
+        h -= magic_bits;
+    }
+    else {
+        // Rebias the exponent and round the mantissa to 10 bits, ties to even
+        uint32_t odd = (x >> 13) & 1;
+        x += ((uint32_t) (15 - 127) << 23) + 0xfff + odd;
+        h = x >> 13;
+    }
+    return (short) (h | (sign >> 16));
+}
+
+inline float toFloat(short half)
+{
+    uint32_t h = (uint16_t) half;
+    uint32_t x = (h & 0x7fff) << 13;
+    uint32_t exponent = x & (0x7c00 << 13);
+    x += (127 - 15) << 23;
+
+    float f;
+    if (exponent == 0x7c00u << 13) {
+        // Infinity or NaN
+        x += (128 - 16) << 23;
+        memcpy(&f, &x, 4);
+    }
+    else if (exponent == 0) {
+        // Zero or subnormal, renormalized by a float subtraction
+        const uint32_t magic_bits = 113 << 23;
+        float magic;
+        x += 1 << 23;
+        memcpy(&f, &x, 4);
+        memcpy(&magic, &magic_bits, 4);
+        f -= magic;
+    }
+    else
+        memcpy(&f, &x, 4);
+
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    bits |= (h & 0x8000) << 16;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+// Arrays of n values
+void fromFloat(const float *src, short *dst, int n);
+void toFloat(const short *src, float *dst, int n);
+
+// dst = alpha * dst + beta * src, dst in half precision, like cv::addWeighted
+void addWeighted(short *dst, float alpha, const float *src, float beta, int n);
+
+// CV_32F matrices of any number of channels to CV_16S ones and back, dst is (re)allocated only if
+// its size or type differs
+void fromFloat(const cv::Mat &src, cv::Mat &dst);
+void toFloat(const cv::Mat &src, cv::Mat &dst);
+
+// dst = alpha * dst + beta * src for a CV_16S dst and a CV_32F src of the same size and channels
+void addWeighted(cv::Mat &dst, float alpha, const cv::Mat &src, float beta);
+}
@@ -0,0 +1,171 @@
+#include "imagepyramid.hpp"
+#include "recttools.hpp"
+#include "patchsampler.hpp"
+#include <assert.h>
+
+void ImagePyramid::build(const cv::Mat &image, int max_levels, int min_size)
+{
+    build(image, cv::Rect(0, 0, image.cols, image.rows), max_levels, min_size);
+}
+
+void ImagePyramid::build(const FrameView &frame, const cv::Rect &region, int max_levels, int min_size)
+{
+    build(frame.mat(), region, max_levels, min_size);
+    _view = frame;
+    _has_view = true;
+}
+
+void ImagePyramid::build(const cv::Mat &image, const cv::Rect &region, int max_levels, int min_size)
+{
+    int n = 1;
+    cv::Size size = image.size();
+    while (n < max_levels && std::min(size.width, size.height) / 2 >= min_size) {
+        size.width /= 2;
+        size.height /= 2;
+        n++;
+    }
+
+    _has_view = false;
+    _colors.release();
+    _color_region = cv::Rect();
+    _levels.resize(n);
+    if (_storage.size() < (size_t) n)
+        _storage.resize(n);
+    _sizes.resize(n);
+    _origins.resize(n);
+    _levels[0] = image;
+    _sizes[0] = image.size();
+    _origins[0] = cv::Point(0, 0);
+
+    // Aligned to the pixels of the coarsest level, every level is exactly half of the part of the previous one
+    int align = 1 << (n - 1);
+    cv::Rect r = region & cv::Rect(0, 0, image.cols, image.rows);
+    int x0 = r.x / align * align;
+    int y0 = r.y / align * align;
+    int x1 = (r.x + r.width + align - 1) / align * align;
+    int y1 = (r.y + r.height + align - 1) / align * align;
+
+    for (int i = 1; i < n; i++) {
+        const cv::Mat &prev = _levels[i - 1];
+        _sizes[i] = cv::Size(_sizes[i - 1].width / 2, _sizes[i - 1].height / 2);
+
+        cv::Rect part(x0 >> i, y0 >> i, 0, 0);
+        part.width = std::min(x1 >> i, _sizes[i].width) - part.x;
+        part.height = std::min(y1 >> i, _sizes[i].height) - part.y;
+        if (part.width <= 0 || part.height <= 0) {
+            // Only the views are dropped, the buffers of the coarser levels stay for the next frames
+            _levels.resize(i);
+            _sizes.resize(i);
+            _origins.resize(i);
+            break;
+        }
+        _origins[i] = part.tl();
+
+        // The part is resized into a view of the buffer of the level, which only grows when the
+        // region gets larger than in any earlier frame, so a moving target does not reallocate it
+        cv::Mat &buffer = _storage[i];
+        if (buffer.type() != image.type() || buffer.cols < part.width || buffer.rows < part.height) {
+            int rows = buffer.type() == image.type() ? std::max(buffer.rows, part.height) : part.height;
+            int cols = buffer.type() == image.type() ? std::max(buffer.cols, part.width) : part.width;
+            buffer.create(rows, cols, image.type());
+            _grown++;
+        }
+        _levels[i] = buffer(cv::Rect(cv::Point(0, 0), part.size()));
+
+        // A whole level is filtered from the whole previous one, with an odd side as before
+        if (part == cv::Rect(cv::Point(0, 0), _sizes[i]) && prev.size() == _sizes[i - 1]) {
+            cv::resize(prev, _levels[i], _sizes[i], 0, 0, cv::INTER_AREA);
+            continue;
+        }
+        cv::Rect src(2 * part.x - _origins[i - 1].x, 2 * part.y - _origins[i - 1].y, 2 * part.width, 2 * part.height);
+        cv::resize(prev(src), _levels[i], part.size(), 0, 0, cv::INTER_AREA);
+    }
+}
+
+void ImagePyramid::convertColors(const cv::Rect &region)
+{
+    assert(_has_view);
+    uchar *storage_data = _color_storage.data, *buffer_data = _color_buffer.data;
+    _color_region = _view.toBGR(region & cv::Rect(cv::Point(0, 0), _sizes[0]), _colors, _color_storage, _color_buffer);
+    _grown += (_color_storage.data != storage_data) + (_color_buffer.data != buffer_data);
+}
+
+int ImagePyramid::levelFor(const cv::Size &window, const cv::Size &out) const
+{
+    int i = 0;
+    while (i + 1 < levels() &&
+           window.width * _sizes[i + 1].width >= out.width * _sizes[0].width &&
+           window.height * _sizes[i + 1].height >= out.height * _sizes[0].height)
+        i++;
+    return i;
+}
+
+int ImagePyramid::levelFor(const cv::Rect &window, const cv::Size &out) const
+{
+    // Only the part inside the frame is read, the rest is replicated from its border
+    cv::Rect inside = window & cv::Rect(0, 0, _sizes[0].width, _sizes[0].height);
+    int i = levelFor(window.size(), out);
+    while (i > 0) {
+        cv::Rect w = toLevel(inside, i);
+        if ((w & covered(i)) == w)
+            break;
+        i--;
+    }
+    return i;
+}
+
+cv::Rect ImagePyramid::toLevel(const cv::Rect &window, int i) const
+{
+    if (i == 0)
+        return window;
+
+    float fx = _sizes[i].width / (float) _sizes[0].width;
+    float fy = _sizes[i].height / (float) _sizes[0].height;
+    int x1 = cvRound(window.x * fx);
+    int y1 = cvRound(window.y * fy);
+    int x2 = cvRound((window.x + window.width) * fx);
+    int y2 = cvRound((window.y + window.height) * fy);
+    return cv::Rect(x1, y1, std::max(x2 - x1, 1), std::max(y2 - y1, 1));
+}
+
+cv::Mat ImagePyramid::subwindow(const cv::Rect &window, const cv::Size &out, int borderType, cv::Mat &buffer, cv::Mat &resized, int interpolation) const
+{
+    // Where the window leaves the covered part it also leaves the frame, so the border is the same
+    int i = levelFor(window, out);
+    const cv::Mat &level = _levels[i];
+    cv::Rect w = toLevel(window, i) - _origins[i];
+
+    // A window of the output size inside the level is used in place
+    if (w.size() == out && (w & cv::Rect(0, 0, level.cols, level.rows)) == w)
+        return level(w);
+
+    // Otherwise replicate the border and resize in one pass, straight into resized
+    if (borderType == cv::BORDER_REPLICATE && PatchSampler::sample(level, w, out, interpolation, resized, buffer))
+        return resized;
+
+    cv::Mat z = RectTools::subwindow(level, w, borderType, buffer);
+    if (z.size() != out) {
+        cv::resize(z, resized, out, 0, 0, interpolation);
+        z = resized;
+    }
+    return z;
+}
+
+bool ImagePyramid::extractImage(float cx, float cy, float patch_width, float patch_height, const cv::Size &out, cv::Mat &resized, cv::Mat &buffer) const
+{
+    cv::Rect window = RectTools::extractRect(_levels[0], cx, cy, patch_width, patch_height);
+    if (window.width <= 0 || window.height <= 0)
+        return false;
+
+    int i = levelFor(window, out);
+    window = toLevel(window, i);
+    RectTools::limit(window, covered(i));
+    if (window.width <= 0 || window.height <= 0)
+        return false;
+    window -= _origins[i];
+
+    int interpolation = out.width > window.width ? cv::INTER_LINEAR : cv::INTER_AREA;
+    if (!PatchSampler::sample(_levels[i], window, out, interpolation, resized, buffer))
+        cv::resize(_levels[i](window), resized, out, 0, 0, interpolation);
+    return true;
+}
@@ -0,0 +1,90 @@
+/*
+Multi-resolution pyramid of a frame, to sample tracker patches from.
+
+Level 0 is the frame itself (not copied), every further level halves the previous one
+with a box filter. The further levels may be limited to a region of the frame, around the
+targets, so that a large frame is not filtered where no patch is read from. A patch is read from the coarsest level that still has at least as
+many pixels as the patch is resized to, so large windows touch few pixels. Once build()
+returned the pyramid is only read from: it is built once per frame and can be shared by
+several trackers, also from different threads.
+*/
+
+#pragma once
+
+#include "frameview.hpp"
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+class ImagePyramid
+{
+public:
+    ImagePyramid() : _has_view(false), _grown(0) {}
+
+    // Build the levels of image, at most max_levels of them, stopping before the smaller side gets below min_size.
+    // The levels above 0 are views of grow-only buffers, one per level, which are reused from frame to frame.
+    void build(const cv::Mat &image, int max_levels = 8, int min_size = 32);
+
+    // Same, but the levels above 0 only cover region of the frame, extended to whole pixels of the
+    // coarsest level. Windows that are not covered are read from a finer level, at worst the frame.
+    void build(const cv::Mat &image, const cv::Rect &region, int max_levels = 8, int min_size = 32);
+
+    // Same for a borrowed frame, built from frame.mat(). The view is kept for view(), its pixels must stay valid
+    // while the pyramid is used.
+    void build(const FrameView &frame, const cv::Rect &region, int max_levels = 8, int min_size = 32);
+
+    int levels() const { return (int) _levels.size(); }
+    const cv::Mat &level(int i) const { return _levels[i]; }
+    const cv::Mat &image() const { return _levels[0]; }
+
+    // Size of the whole level i, and the part of it that level(i) holds, in level coordinates
+    cv::Size levelSize(int i) const { return _sizes[i]; }
+    cv::Rect covered(int i) const { return cv::Rect(_origins[i], _levels[i].size()); }
+
+    // BGR colors of region of the frame of a FrameView pyramid, converted once for the Lab features of
+    // all the trackers sampling from it, which otherwise convert the windows they need each. build()
+    // drops them.
+    void convertColors(const cv::Rect &region);
+
+    // The colors of convertColors() and the part of the frame they hold, empty without
+    const cv::Mat &colors() const { return _colors; }
+    cv::Rect colorRegion() const { return _color_region; }
+
+    // Number of times the buffer of a level or of the colors had to grow (or change its type), since construction
+    int grown() const { return _grown; }
+
+    // The frame the pyramid was built from, when it was given as a FrameView, NULL otherwise
+    const FrameView *view() const { return _has_view ? &_view : NULL; }
+
+    // Coarsest level at which a frame window of size window still has at least out pixels in both directions
+    int levelFor(const cv::Size &window, const cv::Size &out) const;
+
+    // Same, and whose covered part holds the frame pixels of window
+    int levelFor(const cv::Rect &window, const cv::Size &out) const;
+
+    // Same as RectTools::subwindow on the frame followed by cv::resize to out. window is in frame
+    // coordinates, resized the storage for the result and buffer the grow-only storage for the
+    // PatchSampler, which does both steps at once for 8 bit frames and BORDER_REPLICATE (or for the
+    // border otherwise). A window of size out inside the frame is returned without a copy.
+    cv::Mat subwindow(const cv::Rect &window, const cv::Size &out, int borderType, cv::Mat &buffer, cv::Mat &resized, int interpolation = cv::INTER_LINEAR) const;
+
+    // Same as RectTools::extractImage on the frame followed by cv::resize to out, with INTER_LINEAR
+    // when the patch is enlarged and INTER_AREA otherwise, sampled into resized like subwindow().
+    // Returns false for an empty patch.
+    bool extractImage(float cx, float cy, float patch_width, float patch_height, const cv::Size &out, cv::Mat &resized, cv::Mat &buffer) const;
+
+private:
+    // window in the coordinates of level i
+    cv::Rect toLevel(const cv::Rect &window, int i) const;
+
+    std::vector<cv::Mat> _levels;  // level 0 is the frame, the others views of _storage
+    std::vector<cv::Mat> _storage; // grow-only buffers of the levels above 0
+    std::vector<cv::Size> _sizes;
+    std::vector<cv::Point> _origins; // top left of level(i) in level i
+    FrameView _view;
+    bool _has_view;
+    cv::Mat _colors;        // view of _color_storage
+    cv::Mat _color_storage; // grow-only storage of the colors
+    cv::Mat _color_buffer;  // grow-only storage of the NV12 planes of the region, gathered for the conversion
+    cv::Rect _color_region;
+    int _grown;
+};
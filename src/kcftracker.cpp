@@ -86,6 +86,187 @@ the use of this software, even if advised of the possibility of such damage.
 #include "recttools.hpp"
 #include "fhog.hpp"
 #include "labdata.hpp"
+#include "workstealingpool.hpp"
+#include "patchsampler.hpp"
+#include "constantcache.hpp"
+#include "trackerkernels.hpp"
+#include "halffloat.hpp"
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <tuple>
+#endif
+
+// The translation constants depend on the feature size (rows, cols), padding and output_sigma_factor
+typedef std::tuple<int, int, float, float> TranslationKey;
+
+// The scale constants on n_scales, scale_step, scale_sigma_factor, fast_scale and n_interp_scales
+typedef std::tuple<int, float, float, bool, int> ScaleKey;
+
+// Snapshot blobs start with this, followed by the layout version
+static const uint32_t SNAPSHOT_MAGIC = 0x3146434b; // "KCF1"
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+// Append a value, or a matrix as rows, cols, type and its elements
+template <typename T>
+static void putValue(std::vector<uchar> &blob, const T &value)
+{
+    const uchar *p = (const uchar *) &value;
+    blob.insert(blob.end(), p, p + sizeof(T));
+}
+
+static void putMat(std::vector<uchar> &blob, const cv::Mat &m)
+{
+    putValue(blob, (int32_t) m.rows);
+    putValue(blob, (int32_t) m.cols);
+    putValue(blob, (int32_t) m.type());
+    for (int i = 0; i < m.rows; i++)
+        blob.insert(blob.end(), m.ptr(i), m.ptr(i) + m.cols * m.elemSize());
+}
+
+// Read what putValue and putMat wrote, false once the blob is too short or malformed
+template <typename T>
+static bool getValue(const uchar *&p, const uchar *end, T &value)
+{
+    if (end - p < (ptrdiff_t) sizeof(T))
+        return false;
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+// A matrix of the given type, or an empty one, which putMat writes with the type of cv::Mat()
+static bool getMat(const uchar *&p, const uchar *end, int expected_type, cv::Mat &m)
+{
+    int32_t rows, cols, type;
+    if (!getValue(p, end, rows) || !getValue(p, end, cols) || !getValue(p, end, type) || rows < 0 || cols < 0)
+        return false;
+    if (rows == 0 || cols == 0) {
+        m.release();
+        return true;
+    }
+    if (type != expected_type)
+        return false;
+    size_t bytes = (size_t) rows * cols * CV_ELEM_SIZE(type);
+    if ((size_t) (end - p) < bytes)
+        return false;
+    m.create(rows, cols, type);
+    memcpy(m.data, p, bytes);
+    p += bytes;
+    return true;
+}
+
+// Finite and larger than zero
+static bool positive(float value)
+{
+    return std::isfinite(value) && value > 0;
+}
+
+// model = src, in half precision with half
+static void storeModel(const cv::Mat &src, cv::Mat &model, bool half)
+{
+    if (half)
+        HalfFloat::fromFloat(src, model);
+    else
+        src.copyTo(model);
+}
+
+// model = (1 - rate) * model + rate * x, in the precision of the model
+static void updateModel(cv::Mat &model, const cv::Mat &x, float rate)
+{
+    if (model.depth() == CV_16S)
+        HalfFloat::addWeighted(model, 1 - rate, x, rate);
+    else
+        cv::addWeighted(model, 1 - rate, x, rate, 0, model);
+}
+
+// The values of a model as floats
+static cv::Mat floatModel(const cv::Mat &model)
+{
+    if (model.depth() != CV_16S)
+        return model;
+    cv::Mat values;
+    HalfFloat::toFloat(model, values);
+    return values;
+}
+
+// Nearest of the Lab centroids for the center color of every quantized BGR bin
+static cv::Mat createLabLut(const cv::Mat &centroids)
+{
+    const int levels = 1 << LAB_LUT_BITS;
+    const int shift = 8 - LAB_LUT_BITS;
+    cv::Mat bgr(1, levels * levels * levels, CV_8UC3);
+    for (int b = 0; b < levels; b++)
+        for (int g = 0; g < levels; g++)
+            for (int r = 0; r < levels; r++) {
+                uchar half = (1 << shift) / 2;
+                bgr.at<cv::Vec3b>(0, (b << (2 * LAB_LUT_BITS)) | (g << LAB_LUT_BITS) | r) =
+                    cv::Vec3b((b << shift) + half, (g << shift) + half, (r << shift) + half);
+            }
+
+    cv::Mat lab;
+    cv::cvtColor(bgr, lab, CV_BGR2Lab);
+
+    cv::Mat lut(1, lab.cols, CV_8U);
+    const float *inputCentroid = centroids.ptr<float>();
+    for (int i = 0; i < lab.cols; i++) {
+        cv::Vec3b c = lab.at<cv::Vec3b>(0, i);
+        float l = (float) c[0];
+        float a = (float) c[1];
+        float b = (float) c[2];
+
+        float minDist = FLT_MAX;
+        int minIdx = 0;
+        for (int k = 0; k < centroids.rows; ++k) {
+            float dist = ( (l - inputCentroid[3*k]) * (l - inputCentroid[3*k]) )
+                       + ( (a - inputCentroid[3*k+1]) * (a - inputCentroid[3*k+1]) )
+                       + ( (b - inputCentroid[3*k+2]) * (b - inputCentroid[3*k+2]) );
+            if (dist < minDist) {
+                minDist = dist;
+                minIdx = k;
+            }
+        }
+        lut.at<uchar>(0, i) = (uchar) minIdx;
+    }
+    return lut;
+}
+
+#ifdef KCF_CHECK_ALLOCATIONS
+// Debug check of the zero-allocation steady state: counts the cv::Mat buffer allocations made by each thread
+static thread_local long t_matAllocations = 0;
+
+class CountingMatAllocator : public cv::MatAllocator
+{
+public:
+    CountingMatAllocator() : _std(cv::Mat::getStdAllocator()) {}
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const
+    {
+        if (!data)
+            t_matAllocations++;
+        return _std->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const
+    {
+        return _std->allocate(data, accessflags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* data) const
+    {
+        _std->deallocate(data);
+    }
+
+private:
+    cv::MatAllocator *_std;
+};
+
+static void installCountingMatAllocator()
+{
+    static CountingMatAllocator allocator;
+    static bool installed = (cv::Mat::setDefaultAllocator(&allocator), true);
+    (void) installed;
+}
 #endif
 
 // Constructor
@@ -95,6 +276,37 @@ KCFTracker::KCFTracker(bool hog, bool fixed_window, bool multiscale, bool lab)
     // Parameters equal in all cases
     lambda = 0.0001;
     padding = 2.5;
+    scale_threads = 0;
+    scale_executor = NULL;
+    scale_reuse_sample = false;
+    pyramid_levels = 8;
+    fast_scale = false;
+    n_interp_scales = 33;
+    scaleFactors = NULL;
+    interpScaleFactors = NULL;
+    min_scale_factor = 0;
+    max_scale_factor = 0;
+    _initialized = false;
+    adaptive = false;
+    adaptive_stable_psr = 20;
+    adaptive_scale_interval = 5;
+    adaptive_min_psr = 7;
+    bounded_cost = false;
+    max_window_pixels = 0;
+    half_storage = false;
+    _strong_frames = 0;
+    _frames_since_scale = 0;
+    _stages = UpdateStages();
+    diagnostics = DIAG_NONE;
+    _fhog_mismatches = 0;
+    _dft_plan = new FFTTools::DFTPlan();
+    allocFeatureWorkspace(&_ws.fhog);
+    _ws.grown = 0;
+    _updates = 0;
+#ifdef KCF_CHECK_ALLOCATIONS
+    installCountingMatAllocator();
+    _check_started = false;
+#endif
     //output_sigma_factor = 0.1;
     output_sigma_factor = 0.125;
 
@@ -116,6 +328,7 @@ KCFTracker::KCFTracker(bool hog, bool fixed_window, bool multiscale, bool lab)
 
             _labfeatures = true;
             _labCentroids = cv::Mat(nClusters, 3, CV_32FC1, &data);
+            _labLut = createLabLut(_labCentroids);
             cell_sizeQ = cell_size*cell_size;
         }
         else{
@@ -167,38 +380,221 @@ KCFTracker::KCFTracker(bool hog, bool fixed_window, bool multiscale, bool lab)
 // Destructor
 KCFTracker::~KCFTracker()
 {
-   printf("KCFTracker Destructor.\n");
-
    _alphaf.release();
    _prob.release();
    _tmpl.release();
    _num.release();
    _den.release();
    _labCentroids.release();
+   _labLut.release();
    sf_den.release();
    sf_num.release();
    
    hann.release();
    s_hann.release();
    ysf.release();
+
+   delete _dft_plan;
+   freeFeatureWorkspace(&_ws.fhog);
+   for (size_t i = 0; i < _ws.scale_fhog.size(); i++)
+       freeFeatureWorkspace(&_ws.scale_fhog[i]);
 }
 
 
 // Initialize tracker
 void KCFTracker::init(const cv::Rect &roi, cv::Mat image)
+{
+    _ws.pyramid.build(image, pyramid_levels);
+    init(roi, _ws.pyramid);
+}
+
+// Initialize tracker from the pyramid of the initial frame
+void KCFTracker::init(const cv::Rect &roi, const ImagePyramid &pyramid)
 {
     _roi = roi;
     assert(roi.width >= 0 && roi.height >= 0);
-    _tmpl = getFeatures(image, 1);
-    _prob = createGaussianPeak(size_patch[0], size_patch[1]);
-    _alphaf = cv::Mat(size_patch[0], size_patch[1], CV_32FC2, float(0));
-
-    dsstInit(roi, image);
+    _frame_size = pyramid.image().size();
+    currentScaleFactor = 1;
+    _strong_frames = 0;
+    _frames_since_scale = 0;
+    _stages = UpdateStages();
+    const FeatureTensor &x = getFeatures(pyramid, 1);
+    // dsstInit computes no translation features, xf stays valid until the training below
+    cv::Mat xf = fftFeatures(x);
+    storeModel(xf, _tmpl, half_storage);
+    _updates = 0;
+    _alphaf.create(size_patch[0], size_patch[1], CV_32F);
+    _alphaf.setTo(0);
+
+    dsstInit(roi, pyramid);
     //_num = cv::Mat(size_patch[0], size_patch[1], CV_32FC2, float(0));
     //_den = cv::Mat(size_patch[0], size_patch[1], CV_32FC2, float(0));
-    train(_tmpl, 1.0); // train with initial frame
+    train(xf, 1.0); // train with initial frame
+    _initialized = true;
  }
 
+// Start tracking anew, init() keeps what fits the new template size
+void KCFTracker::reinit(const cv::Rect &roi, cv::Mat image)
+{
+    init(roi, image);
+}
+
+void KCFTracker::reinit(const cv::Rect &roi, const ImagePyramid &pyramid)
+{
+    init(roi, pyramid);
+}
+
+// Serialize the model, see restore() for the layout
+std::vector<uchar> KCFTracker::snapshot() const
+{
+    std::vector<uchar> blob;
+    putValue(blob, SNAPSHOT_MAGIC);
+    putValue(blob, SNAPSHOT_VERSION);
+
+    // Features, checked by restore()
+    putValue(blob, (uint8_t) _hogfeatures);
+    putValue(blob, (uint8_t) _labfeatures);
+    putValue(blob, (int32_t) cell_size);
+
+    // Translation filter parameters and sizes
+    putValue(blob, interp_factor);
+    putValue(blob, sigma);
+    putValue(blob, lambda);
+    putValue(blob, padding);
+    putValue(blob, output_sigma_factor);
+    putValue(blob, (int32_t) _tmpl_sz.width);
+    putValue(blob, (int32_t) _tmpl_sz.height);
+    putValue(blob, _scale);
+    for (int i = 0; i < 3; i++)
+        putValue(blob, (int32_t) size_patch[i]);
+
+    // Scale filter parameters and sizes
+    putValue(blob, (int32_t) n_scales);
+    putValue(blob, scale_step);
+    putValue(blob, scale_sigma_factor);
+    putValue(blob, scale_lr);
+    putValue(blob, scale_lambda);
+    putValue(blob, (uint8_t) fast_scale);
+    putValue(blob, (int32_t) n_interp_scales);
+    putValue(blob, (int32_t) base_width);
+    putValue(blob, (int32_t) base_height);
+    putValue(blob, (int32_t) scale_model_width);
+    putValue(blob, (int32_t) scale_model_height);
+    putValue(blob, min_scale_factor);
+    putValue(blob, max_scale_factor);
+
+    // State
+    putValue(blob, _roi.x);
+    putValue(blob, _roi.y);
+    putValue(blob, _roi.width);
+    putValue(blob, _roi.height);
+    putValue(blob, currentScaleFactor);
+    putValue(blob, (int32_t) _updates);
+    putMat(blob, floatModel(_tmpl));
+    putMat(blob, _alphaf);
+    putMat(blob, floatModel(sf_num));
+    putMat(blob, sf_den);
+    putMat(blob, fast_scale ? sf_sample : cv::Mat());
+    putMat(blob, fast_scale ? scale_basis : cv::Mat());
+    return blob;
+}
+
+// Take over the model of a snapshot
+bool KCFTracker::restore(const std::vector<uchar> &blob)
+{
+    const uchar *p = blob.empty() ? NULL : &blob[0];
+    const uchar *end = p + blob.size();
+
+    uint32_t magic, version;
+    uint8_t hog, lab, fast;
+    int32_t cell, tmpl_w, tmpl_h, patch[3], scales, interp_scales, width, height, model_w, model_h, updates;
+    float interp, sg, lmb, pad, output_sigma, scale, step, scale_sigma, lr, scale_lmb, min_factor, max_factor;
+    cv::Rect_<float> roi;
+    float factor;
+    cv::Mat tmpl, alphaf, num, den, sample, basis;
+
+    bool ok = getValue(p, end, magic) && magic == SNAPSHOT_MAGIC && getValue(p, end, version) && version == SNAPSHOT_VERSION &&
+        getValue(p, end, hog) && getValue(p, end, lab) && getValue(p, end, cell) &&
+        getValue(p, end, interp) && getValue(p, end, sg) && getValue(p, end, lmb) && getValue(p, end, pad) && getValue(p, end, output_sigma) &&
+        getValue(p, end, tmpl_w) && getValue(p, end, tmpl_h) && getValue(p, end, scale) &&
+        getValue(p, end, patch[0]) && getValue(p, end, patch[1]) && getValue(p, end, patch[2]) &&
+        getValue(p, end, scales) && getValue(p, end, step) && getValue(p, end, scale_sigma) && getValue(p, end, lr) && getValue(p, end, scale_lmb) &&
+        getValue(p, end, fast) && getValue(p, end, interp_scales) && getValue(p, end, width) && getValue(p, end, height) &&
+        getValue(p, end, model_w) && getValue(p, end, model_h) && getValue(p, end, min_factor) && getValue(p, end, max_factor) &&
+        getValue(p, end, roi.x) && getValue(p, end, roi.y) && getValue(p, end, roi.width) && getValue(p, end, roi.height) &&
+        getValue(p, end, factor) && getValue(p, end, updates) &&
+        getMat(p, end, CV_32FC1, tmpl) && getMat(p, end, CV_32FC1, alphaf) && getMat(p, end, CV_32FC2, num) && getMat(p, end, CV_32FC1, den) &&
+        getMat(p, end, CV_32FC1, sample) && getMat(p, end, CV_32FC1, basis) && p == end;
+
+    // The features must be the ones of this tracker, and the translation filter must fit the sizes
+    ok = ok && (bool) hog == _hogfeatures && (bool) lab == _labfeatures && cell == cell_size && cell > 0 &&
+        patch[0] > 0 && patch[1] > 0 && patch[2] > 0 && tmpl_w > 0 && tmpl_h > 0 && positive(scale) &&
+        tmpl.rows == patch[0] * patch[2] && tmpl.cols == patch[1] && alphaf.rows == patch[0] && alphaf.cols == patch[1];
+
+    // The scale filter has one row of FHOG features of the scale model size per scale level, or in the
+    // fast scale mode one row per basis vector of the model sample
+    int scale_features = 0;
+    if (ok && model_w / cell > 2 && model_h / cell > 2)
+        scale_features = (model_w / cell - 2) * (model_h / cell - 2) * (3 * NUM_SECTOR + 4);
+    ok = ok && scale_features > 0 && scales > 0 && width > 0 && height > 0 && positive(step) &&
+        positive(min_factor) && positive(max_factor) && num.cols == scales && den.rows == 1 && den.cols == scales;
+    if (ok && fast)
+        ok = interp_scales > 0 && sample.rows == scale_features && sample.cols == scales &&
+            basis.rows == std::min(scale_features, (int) scales) && basis.cols == scale_features && num.rows == basis.rows;
+    else
+        ok = ok && num.rows == scale_features && sample.empty() && basis.empty();
+
+    // The state must be a usable window
+    ok = ok && std::isfinite(roi.x) && std::isfinite(roi.y) && positive(roi.width) && positive(roi.height) && positive(factor);
+    if (!ok)
+        return false;
+
+    interp_factor = interp;
+    sigma = sg;
+    lambda = lmb;
+    padding = pad;
+    output_sigma_factor = output_sigma;
+    _tmpl_sz = cv::Size(tmpl_w, tmpl_h);
+    _scale = scale;
+    for (int i = 0; i < 3; i++)
+        size_patch[i] = patch[i];
+
+    n_scales = scales;
+    scale_step = step;
+    scale_sigma_factor = scale_sigma;
+    scale_lr = lr;
+    scale_lambda = scale_lmb;
+    fast_scale = fast;
+    n_interp_scales = interp_scales;
+    base_width = width;
+    base_height = height;
+    scale_model_width = model_w;
+    scale_model_height = model_h;
+    min_scale_factor = min_factor;
+    max_scale_factor = max_factor;
+
+    _roi = roi;
+    currentScaleFactor = factor;
+    // The workspace is sized again by the next update(), the allocation check starts after it
+    _updates = 0;
+    storeModel(tmpl, _tmpl, half_storage);
+    alphaf.copyTo(_alphaf);
+    storeModel(num, sf_num, half_storage);
+    den.copyTo(sf_den);
+    sample.copyTo(sf_sample);
+    basis.copyTo(scale_basis);
+
+    // The constants and plans of the sizes, shared with the trackers of the same ones
+    initConstants();
+    initScaleConstants();
+    _frame_size = cv::Size();
+    _strong_frames = 0;
+    _frames_since_scale = 0;
+    _stages = UpdateStages();
+    _initialized = true;
+    return true;
+}
+
 // Initialize tracker
 void KCFTracker::init(const cv::Point pt1, const cv:: Point pt2, cv::Mat image)
 {
@@ -216,6 +612,162 @@ void KCFTracker::init(const cv::Point pt1, const cv:: Point pt2, cv::Mat image)
 // Update position based on the new frame
 cv::Rect KCFTracker::update(cv::Mat image)
 {
+#ifdef KCF_CHECK_ALLOCATIONS
+    startAllocationCheck();
+#endif
+    _ws.pyramid.build(image, searchRegion(), pyramid_levels);
+    return update(_ws.pyramid);
+}
+
+// Initialize tracker from a borrowed frame
+void KCFTracker::init(const cv::Rect &roi, const FrameView &frame)
+{
+    _ws.pyramid.build(frame, cv::Rect(0, 0, frame.width, frame.height), pyramid_levels);
+    init(roi, _ws.pyramid);
+}
+
+// Update position based on a borrowed frame
+cv::Rect KCFTracker::update(const FrameView &frame)
+{
+#ifdef KCF_CHECK_ALLOCATIONS
+    startAllocationCheck();
+#endif
+    _ws.pyramid.build(frame, searchRegion(), pyramid_levels);
+    return update(_ws.pyramid);
+}
+
+// Frame region the patches of the next update() are read from: the detection window, and the
+// training and scale windows around any position the detection can move the target to
+cv::Rect KCFTracker::searchRegion() const
+{
+    // Without the scale factors there is no window yet, ImagePyramid::build() crops this to the frame
+    if (!_initialized)
+        return cv::Rect(0, 0, INT_MAX, INT_MAX);
+
+    float growth = (fast_scale ? interpScaleFactors : scaleFactors)[0];
+    float window_w = _scale * _tmpl_sz.width * currentScaleFactor;
+    float window_h = _scale * _tmpl_sz.height * currentScaleFactor;
+    float w = std::max(window_w, base_width * scaleFactors[0] * currentScaleFactor) * growth;
+    float h = std::max(window_h, base_height * scaleFactors[0] * currentScaleFactor) * growth;
+
+    // The detection moves the center by at most half its window, plus a few pixels for the rounding
+    float width = window_w + w + 2 * cell_size;
+    float height = window_h + h + 2 * cell_size;
+    float cx = _roi.x + _roi.width / 2.0f;
+    float cy = _roi.y + _roi.height / 2.0f;
+    return cv::Rect(cvFloor(cx - width / 2), cvFloor(cy - height / 2), cvCeil(width), cvCeil(height));
+}
+
+// max_scale_factor, or the scale at which the translation window or the largest scale patch reaches
+// max_window_pixels. The cap wins over min_scale_factor, so a target too large for it shrinks.
+float KCFTracker::scaleLimit() const
+{
+    float limit = max_scale_factor;
+    if (_initialized && max_window_pixels > 0) {
+        float window = _scale * _tmpl_sz.width * _scale * _tmpl_sz.height;
+        float patch = base_width * scaleFactors[0] * base_height * scaleFactors[0];
+        float area = std::max(window, patch);
+        if (area > 0)
+            limit = std::min(limit, std::sqrt(max_window_pixels / area));
+    }
+    return limit;
+}
+
+KCFTracker::CostEstimate KCFTracker::estimateCost() const
+{
+    CostEstimate cost;
+    if (!_initialized)
+        return cost;
+
+    cv::Rect region = searchRegion();
+    if (_frame_size.area() > 0)
+        region &= cv::Rect(0, 0, _frame_size.width, _frame_size.height);
+    cost.region_pixels = region.area();
+
+    // The levels of ImagePyramid::build() over the region, each a quarter of the previous one
+    cv::Size size = _frame_size.area() > 0 ? _frame_size : region.size();
+    double level_pixels = cost.region_pixels;
+    for (int i = 1; i < pyramid_levels && std::min(size.width, size.height) / 2 >= 32; i++) {
+        size = cv::Size(size.width / 2, size.height / 2);
+        level_pixels /= 4;
+        cost.pyramid_pixels += 4 * level_pixels;
+    }
+
+    cost.window_pixels = (double) _scale * _tmpl_sz.width * _scale * _tmpl_sz.height * currentScaleFactor * currentScaleFactor;
+    cost.patch_pixels = 2.0 * _tmpl_sz.area();
+    cost.feature_values = 2.0 * size_patch[0] * size_patch[1] * size_patch[2];
+    cost.scale_pixels = 2.0 * n_scales * scale_model_width * scale_model_height;
+    cost.scale_values = 2.0 * (scale_model_width / cell_size - 2) * (scale_model_height / cell_size - 2) * (3 * NUM_SECTOR + 4) * n_scales;
+
+    // The feature values are transformed, O(log n) per value, and correlated; the pixels are filtered
+    // into the pyramid, sampled and filtered once
+    double cells = std::max((double) size_patch[0] * size_patch[1], 2.0);
+    cost.total = cost.pyramid_pixels + cost.patch_pixels + cost.scale_pixels +
+        cost.feature_values * (1 + std::log2(cells)) + cost.scale_values * (1 + std::log2((double) std::max(n_scales, 2)));
+    return cost;
+}
+
+// Colors of the translation patch for the Lab features, when the patch z of window has none: NV12
+// views are converted over just the window, other gray patches are expanded
+const cv::Mat &KCFTracker::colorPatch(const ImagePyramid &pyramid, const cv::Mat &z, const cv::Rect &window)
+{
+    const FrameView *frame = pyramid.view();
+    if (frame == NULL || frame->format != FrameView::NV12) {
+        cv::cvtColor(z, _ws.color, cv::COLOR_GRAY2BGR);
+        return _ws.color;
+    }
+
+    // The colors converted once for all the trackers on the pyramid, when they hold the window
+    uchar *bgr_data = _ws.frame_bgr.data, *yuv_data = _ws.frame_yuv.data, *border_data = _ws.color_border.data;
+    cv::Rect inside = window & cv::Rect(0, 0, frame->width, frame->height);
+    cv::Rect shared = pyramid.colorRegion();
+    if (inside.area() > 0 && (inside & shared) == inside) {
+        PatchSampler::sample(pyramid.colors(), window - shared.tl(), _tmpl_sz, cv::INTER_LINEAR, _ws.color, _ws.color_border);
+        _ws.grown += _ws.color_border.data != border_data;
+        return _ws.color;
+    }
+
+    cv::Rect converted = frame->toBGR(window, _ws.color_window, _ws.frame_bgr, _ws.frame_yuv);
+
+    // The converted part holds all of the window inside the frame, its border is the frame border
+    PatchSampler::sample(_ws.color_window, window - converted.tl(), _tmpl_sz, cv::INTER_LINEAR, _ws.color, _ws.color_border);
+    _ws.grown += (_ws.frame_bgr.data != bgr_data) + (_ws.frame_yuv.data != yuv_data) + (_ws.color_border.data != border_data);
+    return _ws.color;
+}
+
+#ifdef KCF_CHECK_ALLOCATIONS
+// Growth of all grow-only buffers, each of which allocates once per growth
+int KCFTracker::grownBuffers() const
+{
+    int grown = _ws.grown + _ws.pyramid.grown();
+    for (size_t i = 0; i < _ws.scale_grown.size(); i++)
+        grown += _ws.scale_grown[i];
+    return grown;
+}
+
+void KCFTracker::startAllocationCheck()
+{
+    _check_mats = t_matAllocations;
+    _check_fhog = _ws.fhog->allocations;
+    _check_grown = grownBuffers();
+    _check_started = true;
+}
+#endif
+
+// Update position based on the pyramid of the new frame
+cv::Rect KCFTracker::update(const ImagePyramid &pyramid)
+{
+    assert(_initialized);
+    const cv::Mat &image = pyramid.image();
+#ifdef KCF_CHECK_ALLOCATIONS
+    // A pyramid built by the caller is not counted
+    if (!_check_started)
+        startAllocationCheck();
+    _check_started = false;
+#endif
+    _updates++;
+    _frame_size = image.size();
+
     if (_roi.x + _roi.width <= 0) _roi.x = -_roi.width + 1;
     if (_roi.y + _roi.height <= 0) _roi.y = -_roi.height + 1;
     if (_roi.x >= image.cols - 1) _roi.x = image.cols - 2;
@@ -224,10 +776,17 @@ cv::Rect KCFTracker::update(cv::Mat image)
     float cx = _roi.x + _roi.width / 2.0f;
     float cy = _roi.y + _roi.height / 2.0f;
 
-    float peak_value;
-    cv::Point2f res = detect(_tmpl, getFeatures(image, 0, 1.0f), peak_value);
+    float peak_value, psr = 0;
+    cv::Point2f res = detect(_tmpl, fftFeatures(getFeatures(pyramid, 0, 1.0f)), peak_value, adaptive ? &psr : NULL);
 
-    //printf("Peak value: %f\n", peak_value);
+    bool confident, search_scale;
+    gateStages(psr, confident, search_scale);
+
+    _stages.peak_value = peak_value;
+    _stages.psr = psr;
+    _stages.scale_detected = search_scale;
+    _stages.scale_trained = search_scale;
+    _stages.trained = confident;
 
     // Adjust by cell size and _scale
     _roi.x = cx - _roi.width / 2.0f + ((float) res.x * cell_size * _scale * currentScaleFactor);
@@ -239,14 +798,23 @@ cv::Rect KCFTracker::update(cv::Mat image)
     if (_roi.y + _roi.height <= 0) _roi.y = -_roi.height + 2;
 
     // Update scale
-    cv::Point2i scale_pi = detect_scale(image);
-    currentScaleFactor = currentScaleFactor * scaleFactors[scale_pi.x];
-    if(currentScaleFactor < min_scale_factor)
-      currentScaleFactor = min_scale_factor;
-    // else if(currentScaleFactor > max_scale_factor)
-    //   currentScaleFactor = max_scale_factor;
-
-    train_scale(image);
+    if (search_scale) {
+        cv::Point2i scale_pi = detect_scale(pyramid);
+        float detectScaleFactor = currentScaleFactor;
+        currentScaleFactor = currentScaleFactor * (fast_scale ? interpScaleFactors : scaleFactors)[scale_pi.x];
+        if(currentScaleFactor < min_scale_factor)
+          currentScaleFactor = min_scale_factor;
+        // Without bounded_cost the target may grow up to the frame size, and the work with it
+        if(bounded_cost && currentScaleFactor > scaleLimit())
+          currentScaleFactor = scaleLimit();
+
+        // The training levels are the detection levels shifted by the chosen one, unless the scale was clamped
+        int reuse_shift = INT_MAX;
+        if (scale_reuse_sample && !fast_scale && currentScaleFactor == detectScaleFactor * scaleFactors[scale_pi.x])
+          reuse_shift = scale_pi.x - ((int)std::ceil(n_scales / 2.0f) - 1);
+
+        train_scale(pyramid, false, reuse_shift);
+    }
 
     if (_roi.x >= image.cols - 1) _roi.x = image.cols - 1;
     if (_roi.y >= image.rows - 1) _roi.y = image.rows - 1;
@@ -255,25 +823,67 @@ cv::Rect KCFTracker::update(cv::Mat image)
 
 
     assert(_roi.width >= 0 && _roi.height >= 0);
-    cv::Mat x = getFeatures(image, 0);
-    train(x, interp_factor);
+    if (confident) {
+        cv::Mat xf = fftFeatures(getFeatures(pyramid, 0));
+        train(xf, interp_factor);
+    }
 
+#ifdef KCF_CHECK_ALLOCATIONS
+    // The first update sizes the buffers init() does not use. After that, the only allowed
+    // allocations are the grow-only subwindow and pyramid buffers growing for a larger window.
+    // The diagnostics allocate, the check is off while they run.
+    if (_updates > 1 && diagnostics == DIAG_NONE) {
+        assert(t_matAllocations - _check_mats == grownBuffers() - _check_grown);
+        assert(_ws.fhog->allocations == _check_fhog);
+    }
+#endif
 
     return _roi;
 }
 
 // Detect the new scaling rate
-cv::Point2i KCFTracker::detect_scale(cv::Mat image)
+cv::Point2i KCFTracker::detect_scale(const ImagePyramid & pyramid)
 {
-  cv::Mat xsf = KCFTracker::get_scale_sample(image);
+  KCF_PROFILE_SCOPE(_profile, DETECT_SCALE);
+  cv::Mat xsf = KCFTracker::get_scale_sample(pyramid);
 
   // Compute AZ in the paper
-  cv::Mat add_temp;
-  cv::reduce(FFTTools::complexMultiplication(sf_num, xsf), add_temp, 0, CV_REDUCE_SUM);
+  cv::Mat &add_temp = _ws.add_temp;
+  if(sf_num.depth() == CV_16S)
+  {
+    // Convert the half precision model a row at a time, and sum the products right away
+    int n = xsf.cols;
+    add_temp.create(1, n, CV_32FC2);
+    add_temp.setTo(0);
+    _ws.scale_row.create(1, n, CV_32FC2);
+    float *row = _ws.scale_row.ptr<float>();
+    float *sum = add_temp.ptr<float>();
+    for(int i = 0; i < xsf.rows; i++)
+    {
+      HalfFloat::toFloat(sf_num.ptr<short>(i), row, 2 * n);
+      FFTTools::complexMultiplicationKernel(row, xsf.ptr<float>(i), row, n);
+      for(int j = 0; j < 2 * n; j++)
+        sum[j] += row[j];
+    }
+  }
+  else
+  {
+    FFTTools::complexMultiplication(sf_num, xsf, _ws.scale_prod); // keep xsf for get_scale_sample(pyramid, shift)
+    cv::reduce(_ws.scale_prod, add_temp, 0, CV_REDUCE_SUM);
+  }
 
   // compute the final y
-  cv::Mat scale_response;
-  cv::idft(FFTTools::complexDivisionReal(add_temp, (sf_den + scale_lambda)), scale_response, cv::DFT_REAL_OUTPUT);
+  cv::Mat &scale_response = _ws.scale_response;
+  cv::add(sf_den, cv::Scalar(scale_lambda), _ws.scale_den);
+  FFTTools::complexDivisionReal(add_temp, _ws.scale_den, add_temp);
+  if(fast_scale)
+  {
+    // Interpolate the response of the sampled levels to n_interp_scales
+    FFTTools::resizeSpectrum(add_temp, _ws.scale_interp, n_interp_scales);
+    cv::idft(_ws.scale_interp, scale_response, cv::DFT_REAL_OUTPUT);
+  }
+  else
+    cv::idft(add_temp, scale_response, cv::DFT_REAL_OUTPUT);
 
   // Get the max point as the final scaling rate
   cv::Point2i pi;
@@ -285,18 +895,23 @@ cv::Point2i KCFTracker::detect_scale(cv::Mat image)
 
 
 // Detect object in the current frame.
-cv::Point2f KCFTracker::detect(cv::Mat z, cv::Mat x, float &peak_value)
+cv::Point2f KCFTracker::detect(cv::Mat zf, cv::Mat xf, float &peak_value, float *psr)
 {
+    KCF_PROFILE_SCOPE(_profile, DETECT);
     using namespace FFTTools;
 
-    cv::Mat k = gaussianCorrelation(x, z);
-    cv::Mat res = (real(fftd(complexMultiplication(_alphaf, fftd(k)), true)));
+    cv::Mat &res = _ws.res;
+    _dft_plan->forward(gaussianCorrelation(xf, zf), _ws.kf);
+    cv::mulSpectrums(_alphaf, _ws.kf, res, 0);
+    _dft_plan->inverse(res, res);
 
     //minMaxLoc only accepts doubles for the peak, and integer points for the coordinates
     cv::Point2i pi;
     double pv;
     cv::minMaxLoc(res, NULL, &pv, NULL, &pi);
     peak_value = (float) pv;
+    if (psr)
+        *psr = peakToSidelobe(res, pi, peak_value);
 
     //subpixel peak estimation, coordinates will be non-integer
     cv::Point2f p((float)pi.x, (float)pi.y);
@@ -315,16 +930,61 @@ cv::Point2f KCFTracker::detect(cv::Mat z, cv::Mat x, float &peak_value)
     return p;
 }
 
+// (peak - mean) / stddev of the response outside a window of a tenth of its size around the peak
+float KCFTracker::peakToSidelobe(const cv::Mat &res, const cv::Point &peak, float peak_value)
+{
+    int r = std::max(1, std::min(res.rows, res.cols) / 10);
+    cv::Rect window(peak.x - r, peak.y - r, 2 * r + 1, 2 * r + 1);
+    window &= cv::Rect(0, 0, res.cols, res.rows);
+
+    double sum = 0, sum2 = 0;
+    for (int y = 0; y < res.rows; y++) {
+        const float *row = res.ptr<float>(y);
+        bool inside_rows = y >= window.y && y < window.y + window.height;
+        for (int x = 0; x < res.cols; x++) {
+            if (inside_rows && x >= window.x && x < window.x + window.width)
+                continue;
+            sum += row[x];
+            sum2 += row[x] * row[x];
+        }
+    }
+
+    int n = res.rows * res.cols - window.area();
+    if (n <= 0)
+        return 0;
+    double mean = sum / n;
+    double stddev = std::sqrt(std::max(sum2 / n - mean * mean, 0.0));
+    return stddev > 0 ? (float) ((peak_value - mean) / stddev) : 0.f;
+}
+
+// The adaptive mode skips the model updates of weak detections, and searches the scale of strong
+// ones on consecutive frames only every adaptive_scale_interval frames
+void KCFTracker::gateStages(float psr, bool &confident, bool &search_scale)
+{
+    confident = !adaptive || psr >= adaptive_min_psr;
+    bool stable = adaptive && psr >= adaptive_stable_psr && _strong_frames > 0;
+    _strong_frames = adaptive && psr >= adaptive_stable_psr ? _strong_frames + 1 : 0;
+    _frames_since_scale++;
+    search_scale = confident && (!stable || _frames_since_scale >= adaptive_scale_interval);
+    if (search_scale)
+        _frames_since_scale = 0;
+}
+
 // train tracker with a single image
-void KCFTracker::train(cv::Mat x, float train_interp_factor)
+void KCFTracker::train(cv::Mat xf, float train_interp_factor)
 {
+    KCF_PROFILE_SCOPE(_profile, TRAIN);
     using namespace FFTTools;
 
-    cv::Mat k = gaussianCorrelation(x, x);
-    cv::Mat alphaf = complexDivision(_prob, (fftd(k) + lambda));
+    cv::Mat k = gaussianCorrelation(xf, xf);
+    // Adding lambda to every frequency of kf is adding it to the kernel at the origin
+    k.at<float>(0, 0) += lambda;
+    _dft_plan->forward(k, _ws.kf);
+    ccsDivision(_prob, _ws.kf, _ws.alphaf);
 
-    _tmpl = (1 - train_interp_factor) * _tmpl + (train_interp_factor) * x;
-    _alphaf = (1 - train_interp_factor) * _alphaf + (train_interp_factor) * alphaf;
+    // The DFT is linear, so interpolating the spectra equals interpolating the features
+    updateModel(_tmpl, xf, train_interp_factor);
+    cv::addWeighted(_alphaf, (1 - train_interp_factor), _ws.alphaf, train_interp_factor, 0, _alphaf);
 
 
     /*cv::Mat kf = fftd(gaussianCorrelation(x, x));
@@ -340,41 +1000,47 @@ void KCFTracker::train(cv::Mat x, float train_interp_factor)
 }
 
 // Evaluates a Gaussian kernel with bandwidth SIGMA for all relative shifts between input images X and Y, which must both be MxN. They must    also be periodic (ie., pre-processed with a cosine window).
-cv::Mat KCFTracker::gaussianCorrelation(cv::Mat x1, cv::Mat x2)
+cv::Mat KCFTracker::gaussianCorrelation(cv::Mat x1f, cv::Mat x2f)
 {
+    KCF_PROFILE_SCOPE(_profile, GAUSSIAN_CORRELATION);
     using namespace FFTTools;
-    cv::Mat c = cv::Mat( cv::Size(size_patch[1], size_patch[0]), CV_32F, cv::Scalar(0) );
-    // HOG features
-    if (_hogfeatures) {
-        cv::Mat caux;
-        cv::Mat x1aux;
-        cv::Mat x2aux;
-        for (int i = 0; i < size_patch[2]; i++) {
-            x1aux = x1.row(i);   // Procedure do deal with cv::Mat multichannel bug
-            x1aux = x1aux.reshape(1, size_patch[0]);
-            x2aux = x2.row(i).reshape(1, size_patch[0]);
-            cv::mulSpectrums(fftd(x1aux), fftd(x2aux), caux, 0, true);
-            caux = fftd(caux, true);
-            rearrange(caux);
-            caux.convertTo(caux,CV_32F);
-            c = c + real(caux);
-        }
-    }
-    // Gray features
-    else {
-        cv::mulSpectrums(fftd(x1), fftd(x2), c, 0, true);
-        c = fftd(c, true);
-        rearrange(c);
-        c = real(c);
-    }
-    cv::Mat d;
-    cv::max(( (cv::sum(x1.mul(x1))[0] + cv::sum(x2.mul(x2))[0])- 2. * c) / (size_patch[0]*size_patch[1]*size_patch[2]) , 0, d);
-
-    cv::Mat k;
-    cv::exp((-d / (sigma * sigma)), k);
+    // The inverse DFT is linear, so the cross-power spectra of all channels are summed
+    // first and brought back to the spatial domain with a single inverse transform
+    cv::Mat &cf = _ws.cf;
+    // Parseval: the squared norm of a feature map is the energy of its spectrum divided by the number of elements
+    double xx, yy;
+    TrackerKernels::correlateSpectra(x1f, x2f, size_patch[2], size_patch[0], cf, _ws.model_row, xx, yy);
+    cv::Mat &c = _ws.c;
+    _dft_plan->inverse(cf, c);
+    rearrange(c);
+
+    double area = size_patch[0] * size_patch[1];
+    xx /= area;
+    yy /= area;
+
+    // k = exp(-max(xx + yy - 2c, 0) / (numel * sigma^2))
+    double numel = size_patch[0]*size_patch[1]*size_patch[2];
+    cv::Mat &k = _ws.k;
+    c.convertTo(k, CV_32F, -2. / numel, (xx + yy) / numel);
+    cv::max(k, 0, k);
+    k.convertTo(k, CV_32F, -1. / (sigma * sigma));
+    cv::exp(k, k);
     return k;
 }
 
+// Transform every feature channel to the frequency domain
+cv::Mat KCFTracker::fftFeatures(const FeatureTensor & x)
+{
+    // Features are real, so each channel is kept as a CCS packed half spectrum (see FFTTools::fftdCCS)
+    cv::Mat &xf = _ws.xf;
+    xf.create(size_patch[0] * size_patch[2], size_patch[1], CV_32F);
+    for (int i = 0; i < size_patch[2]; i++) {
+        cv::Mat xfaux = xf.rowRange(i * size_patch[0], (i + 1) * size_patch[0]);
+        _dft_plan->forward(x.plane(i), xfaux);
+    }
+    return xf;
+}
+
 // Create Gaussian Peak. Function called only in the first frame.
 cv::Mat KCFTracker::createGaussianPeak(int sizey, int sizex)
 {
@@ -393,12 +1059,15 @@ cv::Mat KCFTracker::createGaussianPeak(int sizey, int sizex)
             int jh = j - sxh;
             res(i, j) = std::exp(mult * (float) (ih * ih + jh * jh));
         }
-    return FFTTools::fftd(res);
+    cv::Mat resf;
+    _dft_plan->forward(res, resf);
+    return resf;
 }
 
 // Obtain sub-window from image, with replication-padding and extract features
-cv::Mat KCFTracker::getFeatures(const cv::Mat & image, bool inithann, float scale_adjust)
+const FeatureTensor & KCFTracker::getFeatures(const ImagePyramid & pyramid, bool inithann, float scale_adjust)
 {
+    KCF_PROFILE_SCOPE(_profile, GET_FEATURES);
     cv::Rect extracted_roi;
 
     float cx = _roi.x + _roi.width / 2;
@@ -452,105 +1121,90 @@ cv::Mat KCFTracker::getFeatures(const cv::Mat & image, bool inithann, float scal
     extracted_roi.x = cx - extracted_roi.width / 2;
     extracted_roi.y = cy - extracted_roi.height / 2;
 
-    cv::Mat FeaturesMap;
-    cv::Mat z = RectTools::subwindow(image, extracted_roi, cv::BORDER_REPLICATE);
+    FeatureTensor &FeaturesMap = _ws.features;
 
-    if (z.cols != _tmpl_sz.width || z.rows != _tmpl_sz.height) {
-        cv::resize(z, z, _tmpl_sz);
-    }
+    uchar *border_data = _ws.border.data;
+    cv::Mat z = pyramid.subwindow(extracted_roi, _tmpl_sz, cv::BORDER_REPLICATE, _ws.border, _ws.resized);
+    if (_ws.border.data != border_data)
+        _ws.grown++;
 
-    imshow("z", z);
+#ifdef KCF_DIAGNOSTICS
+    if (diagnostics & DIAG_SHOW_PATCH)
+        imshow("z", z);
+#endif
 
     // HOG features
     if (_hogfeatures) {
+        CvLSVMFeatureMapCaskade *map = &_ws.fhog->map;
         IplImage z_ipl = z;
-        CvLSVMFeatureMapCaskade *map;
-        CvLSVMFeatureMapCaskade *map1;
-        getFeatureMaps(&z_ipl, cell_size, &map);
-        calcFeatureMaps(&z_ipl, cell_size, &map1);
-        int diff = compare_featuremap(map, map1);
-        if (diff < 0)
-            printf("feature is diff!\n");
-        else
-        {
-            printf("feature is same!\n");
+        getFeatureMapsWs(&z_ipl, cell_size, _ws.fhog);
+
+#ifdef KCF_DIAGNOSTICS
+        // Cross-check the workspace FHOG against the reference implementation
+        if (diagnostics & DIAG_CHECK_FHOG) {
+            CvLSVMFeatureMapCaskade *reference;
+            calcFeatureMaps(&z_ipl, cell_size, &reference);
+            if (compare_featuremap(map, reference) < 0) {
+                _fhog_mismatches++;
+                fprintf(stderr, "FHOG features differ from calcFeatureMaps\n");
+            }
+            freeFeatureMapObject(&reference);
         }
+#endif
         
-        normalizeAndTruncate(map,0.2f);
-        PCAFeatureMaps(map);
-        size_patch[0] = map->sizeY;
-        size_patch[1] = map->sizeX;
-        size_patch[2] = map->numFeatures;
-
-        FeaturesMap = cv::Mat(cv::Size(map->numFeatures,map->sizeX*map->sizeY), CV_32F, map->map);  // Procedure do deal with cv::Mat multichannel bug
-        FeaturesMap = FeaturesMap.t();
-        
-        freeFeatureMapObject(&map);
+        // normalizeAndTruncate and PCAFeatureMaps drop the border cells and reduce each cell to 31 features
+        size_patch[0] = map->sizeY - 2;
+        size_patch[1] = map->sizeX - 2;
+        size_patch[2] = NUM_SECTOR * 3 + 4;
+
+        // One plane per channel, the Lab histograms follow the HOG channels
+        int channels = size_patch[2] + (_labfeatures ? _labCentroids.rows : 0);
+        FeaturesMap.create(channels, size_patch[0], size_patch[1]);
+
+        // The HOG channels are written straight into their planes
+        normalizeAndPCAFeatureMapsWs(_ws.fhog, 0.2f, FeaturesMap.ptr(0), 1);
 
         // Lab features
         if (_labfeatures) {
-            cv::Mat imgLab;
-            cvtColor(z, imgLab, CV_BGR2Lab);
-            unsigned char *input = (unsigned char*)(imgLab.data);
-
-            // Sparse output vector
-            cv::Mat outputLab = cv::Mat(_labCentroids.rows, size_patch[0]*size_patch[1], CV_32F, float(0));
-
-            int cntCell = 0;
-            // Iterate through each cell
-            for (int cY = cell_size; cY < z.rows-cell_size; cY+=cell_size){
-                for (int cX = cell_size; cX < z.cols-cell_size; cX+=cell_size){
-                    // Iterate through each pixel of cell (cX,cY)
-                    for(int y = cY; y < cY+cell_size; ++y){
-                        for(int x = cX; x < cX+cell_size; ++x){
-                            // Lab components for each pixel
-                            float l = (float)input[(z.cols * y + x) * 3];
-                            float a = (float)input[(z.cols * y + x) * 3 + 1];
-                            float b = (float)input[(z.cols * y + x) * 3 + 2];
-
-                            // Iterate trough each centroid
-                            float minDist = FLT_MAX;
-                            int minIdx = 0;
-                            float *inputCentroid = (float*)(_labCentroids.data);
-                            for(int k = 0; k < _labCentroids.rows; ++k){
-                                float dist = ( (l - inputCentroid[3*k]) * (l - inputCentroid[3*k]) )
-                                           + ( (a - inputCentroid[3*k+1]) * (a - inputCentroid[3*k+1]) )
-                                           + ( (b - inputCentroid[3*k+2]) * (b - inputCentroid[3*k+2]) );
-                                if(dist < minDist){
-                                    minDist = dist;
-                                    minIdx = k;
-                                }
-                            }
-                            // Store result at output
-                            outputLab.at<float>(minIdx, cntCell) += 1.0 / cell_sizeQ;
-                            //((float*) outputLab.data)[minIdx * (size_patch[0]*size_patch[1]) + cntCell] += 1.0 / cell_sizeQ;
-                        }
-                    }
-                    cntCell++;
-                }
-            }
-            // Update size_patch[2] and add features to FeaturesMap
+            const cv::Mat &color = z.channels() == 3 ? z : colorPatch(pyramid, z, extracted_roi);
+            assert(color.type() == CV_8UC3);
+
+            // Sparse output vector, one plane per centroid
+            cv::Mat outputLabPlanes = FeaturesMap.planes(size_patch[2], channels);
+            outputLabPlanes.setTo(0);
+            TrackerKernels::labHistograms(color, _labLut.ptr<uchar>(), cell_size, _labCentroids.rows, FeaturesMap.ptr(size_patch[2]),
+                                          size_patch[0] * size_patch[1]);
+            // Update size_patch[2], the features are already in FeaturesMap
             size_patch[2] += _labCentroids.rows;
-            FeaturesMap.push_back(outputLab);
         }
     }
     else {
-        FeaturesMap = RectTools::getGrayImage(z);
-        FeaturesMap -= (float) 0.5; // In Paper;
+        // Gray frames are used as they are
+        const cv::Mat *gray = &z;
+        if (z.channels() == 3) {
+            cv::cvtColor(z, _ws.gray, CV_BGR2GRAY);
+            gray = &_ws.gray;
+        }
         size_patch[0] = z.rows;
         size_patch[1] = z.cols;
         size_patch[2] = 1;
+        FeaturesMap.create(1, size_patch[0], size_patch[1]);
+        cv::Mat grayPlane = FeaturesMap.plane(0);
+        gray->convertTo(grayPlane, CV_32F, 1 / 255.f, -0.5); // In Paper;
     }
 
     if (inithann) {
-        createHanningMats();
+        initConstants();
+    }
+    for (int i = 0; i < size_patch[2]; i++) {
+        cv::Mat plane = FeaturesMap.plane(i);
+        cv::multiply(plane, hann, plane);
     }
-    FeaturesMap = hann.mul(FeaturesMap);
     return FeaturesMap;
 }
 
-// Initialize Hanning window. Function called only in the first frame.
-void KCFTracker::createHanningMats()
+// Create the Hanning window. Function called only in the first frame.
+cv::Mat KCFTracker::createHanningMats()
 {
     cv::Mat hann1t = cv::Mat(cv::Size(size_patch[1],1), CV_32F, cv::Scalar(0));
     cv::Mat hann2t = cv::Mat(cv::Size(1,size_patch[0]), CV_32F, cv::Scalar(0));
@@ -560,22 +1214,22 @@ void KCFTracker::createHanningMats()
     for (int i = 0; i < hann2t.rows; i++)
         hann2t.at<float > (i, 0) = 0.5 * (1 - std::cos(2 * 3.14159265358979323846 * i / (hann2t.rows - 1)));
 
-    cv::Mat hann2d = hann2t * hann1t;
-    // HOG features
-    if (_hogfeatures) {
-        cv::Mat hann1d = hann2d.reshape(1,1); // Procedure do deal with cv::Mat multichannel bug
+    // One 2-D window, getFeatures applies it to every channel plane
+    return hann2t * hann1t;
+}
 
-        hann = cv::Mat(cv::Size(size_patch[0]*size_patch[1], size_patch[2]), CV_32F, cv::Scalar(0));
-        for (int i = 0; i < size_patch[2]; i++) {
-            for (int j = 0; j<size_patch[0]*size_patch[1]; j++) {
-                hann.at<float>(i,j) = hann1d.at<float>(0,j);
-            }
-        }
-    }
-    // Gray features
-    else {
-        hann = hann2d;
-    }
+void KCFTracker::initConstants()
+{
+    static ConstantCache<TranslationKey, TranslationConstants> cache;
+
+    _dft_plan->create(size_patch[0], size_patch[1]);
+    TranslationKey key(size_patch[0], size_patch[1], padding, output_sigma_factor);
+    _translation_constants = cache.get(key, [this](TranslationConstants &constants) {
+        constants.hann = createHanningMats();
+        constants.prob = createGaussianPeak(size_patch[0], size_patch[1]);
+    });
+    hann = _translation_constants->hann;
+    _prob = _translation_constants->prob;
 }
 
 // Calculate sub-pixel peak for one dimension
@@ -590,23 +1244,13 @@ float KCFTracker::subPixelPeak(float left, float center, float right)
 }
 
 // Initialization for scales
-void KCFTracker::dsstInit(const cv::Rect &roi, cv::Mat image)
+void KCFTracker::dsstInit(const cv::Rect &roi, const ImagePyramid & pyramid)
 {
   // The initial size for adjusting
   base_width = roi.width;
   base_height = roi.height;
 
-  // Guassian peak for scales (after fft)
-  ysf = computeYsf();
-  s_hann = createHanningMatsForScale();
-
-  // Get all scale changing rate
-  scaleFactors = new float[n_scales];
-  float ceilS = std::ceil(n_scales / 2.0f);
-  for(int i = 0 ; i < n_scales; i++)
-  {
-    scaleFactors[i] = std::pow(scale_step, ceilS - i - 1);
-  }
+  initScaleConstants();
 
   // Get the scaling rate for compressing to the model size
   float scale_model_factor = 1;
@@ -620,43 +1264,102 @@ void KCFTracker::dsstInit(const cv::Rect &roi, cv::Mat image)
   // Compute min and max scaling rate
   min_scale_factor = std::pow(scale_step,
     std::ceil(std::log((std::fmax(5 / (float) base_width, 5 / (float) base_height) * (1 + scale_padding))) / 0.0086));
+  // The largest scale step at which the target still fits the frame. Only bounded_cost uses it, in
+  // steps of its scale_step, as the constant of the minimum corresponds to much finer ones.
   max_scale_factor = std::pow(scale_step,
-    std::floor(std::log(std::fmin(image.rows / (float) base_height, image.cols / (float) base_width)) / 0.0086));
+    std::floor(std::log(std::fmin(pyramid.image().rows / (float) base_height, pyramid.image().cols / (float) base_width)) / std::log(scale_step)));
 
-  train_scale(image, true);
+  train_scale(pyramid, true);
 
 }
 
-// Train method for scaling
-void KCFTracker::train_scale(cv::Mat image, bool ini)
+// Guassian peak for scales (after fft), hanning window and all scale changing rates, shared by the trackers with the same scale parameters
+void KCFTracker::initScaleConstants()
 {
-  cv::Mat xsf = get_scale_sample(image);
+  static ConstantCache<ScaleKey, ScaleConstants> cache;
+  ScaleKey key(n_scales, scale_step, scale_sigma_factor, fast_scale, fast_scale ? n_interp_scales : 0);
+  _scale_constants = cache.get(key, [this](ScaleConstants &constants) {
+    constants.ysf = computeYsf();
+    constants.s_hann = createHanningMatsForScale();
+
+    // Get all scale changing rate
+    std::vector<float> &factors = constants.scaleFactors;
+    factors.resize(n_scales);
+    float ceilS = std::ceil(n_scales / 2.0f);
+    for(int i = 0 ; i < n_scales; i++)
+    {
+      factors[i] = std::pow(scale_step, ceilS - i - 1);
+    }
 
-  // Adjust ysf to the same size as xsf in the first time
-  if(ini)
+    // In the fast scale mode the sampled levels are n_interp_scales / n_scales steps apart, and the
+    // response is interpolated back to single steps. Interpolated bin k sits at sampled level
+    // k * n_scales / n_interp_scales.
+    if(fast_scale)
+    {
+      float levelSteps = n_interp_scales / (float) n_scales;
+      for(int i = 0 ; i < n_scales; i++)
+        factors[i] = std::pow(scale_step, (ceilS - i - 1) * levelSteps);
+
+      constants.interpScaleFactors.resize(n_interp_scales);
+      for(int k = 0; k < n_interp_scales; k++)
+        constants.interpScaleFactors[k] = std::pow(scale_step, (ceilS - 1) * levelSteps - k);
+    }
+  });
+  ysf = _scale_constants->ysf;
+  s_hann = _scale_constants->s_hann;
+  scaleFactors = &_scale_constants->scaleFactors[0];
+  interpScaleFactors = fast_scale ? &_scale_constants->interpScaleFactors[0] : NULL;
+}
+
+// Train method for scaling
+void KCFTracker::train_scale(const ImagePyramid & pyramid, bool ini, int reuse_shift)
+{
+  KCF_PROFILE_SCOPE(_profile, TRAIN_SCALE);
+  cv::Mat xsf;
+  if(fast_scale)
   {
-    int totalSize = xsf.rows;
-    ysf = cv::repeat(ysf, totalSize, 1);
+    // The PCA basis follows the model, so update the model before compressing the new sample
+    cv::Mat xs = get_scale_levels(pyramid);
+    if(ini)
+      xs.copyTo(sf_sample);
+    else
+      cv::addWeighted(sf_sample, (1 - scale_lr), xs, scale_lr, 0, sf_sample);
+    update_scale_basis();
+    xsf = get_scale_spectra();
   }
+  else
+    xsf = reuse_shift == INT_MAX ? get_scale_sample(pyramid) : get_scale_sample(pyramid, reuse_shift);
 
-  // Get new GF in the paper (delta A)
-  cv::Mat new_sf_num;
-  cv::mulSpectrums(ysf, xsf, new_sf_num, 0, true);
+  // Get new GF in the paper (delta A). The fast scale mode takes the numerator from the
+  // compressed model instead, as the basis changes every frame.
+  cv::Mat &new_sf_num = _ws.new_sf_num;
+  if(fast_scale)
+  {
+    cv::gemm(scale_basis, sf_sample, 1, cv::noArray(), 0, _ws.xsp);
+    cv::dft(_ws.xsp, _ws.sf_sample_f, cv::DFT_ROWS | cv::DFT_COMPLEX_OUTPUT);
+    FFTTools::mulSpectrumRows(ysf, _ws.sf_sample_f, new_sf_num);
+  }
+  else
+    FFTTools::mulSpectrumRows(ysf, xsf, new_sf_num);
 
   // Get Sigma{FF} in the paper (delta B)
-  cv::Mat new_sf_den;
-  cv::mulSpectrums(xsf, xsf, new_sf_den, 0, true);
-  cv::reduce(FFTTools::real(new_sf_den), new_sf_den, 0, CV_REDUCE_SUM);
+  cv::Mat &new_sf_den = _ws.new_sf_den;
+  cv::mulSpectrums(xsf, xsf, _ws.new_sf_den_full, 0, true);
+  cv::reduce(_ws.new_sf_den_full, _ws.new_sf_den_sum, 0, CV_REDUCE_SUM);
+  cv::extractChannel(_ws.new_sf_den_sum, new_sf_den, 0);
+
+  if(ini || fast_scale)
+    storeModel(new_sf_num, sf_num, half_storage);
+  else
+    updateModel(sf_num, new_sf_num, scale_lr);
 
   if(ini)
   {
-    sf_den = new_sf_den;
-    sf_num = new_sf_num;
+    new_sf_den.copyTo(sf_den);
   }else
   {
     // Get new A and new B
     cv::addWeighted(sf_den, (1 - scale_lr), new_sf_den, scale_lr, 0, sf_den);
-    cv::addWeighted(sf_num, (1 - scale_lr), new_sf_num, scale_lr, 0, sf_num);
   }
 
   update_roi();
@@ -681,90 +1384,186 @@ void KCFTracker::update_roi()
 
 }
 
+// Computes the scale levels of the stripes in range, each stripe with its own buffers
+class KCFTracker::ScaleSampleBody : public cv::ParallelLoopBody
+{
+public:
+  ScaleSampleBody(KCFTracker *tracker, const ImagePyramid & pyramid, int nstripes)
+    : _tracker(tracker), _pyramid(pyramid), _nstripes(nstripes) {}
+
+  virtual void operator()(const cv::Range & range) const
+  {
+    int n_scales = _tracker->n_scales;
+    for(int stripe = range.start; stripe < range.end; stripe++)
+    {
+      int begin = stripe * n_scales / _nstripes;
+      int end = (stripe + 1) * n_scales / _nstripes;
+      for(int i = begin; i < end; i++)
+        _tracker->get_scale_level(_pyramid, i, stripe);
+    }
+  }
+
+private:
+  KCFTracker *_tracker;
+  const ImagePyramid & _pyramid;
+  int _nstripes;
+};
+
 // Compute the F^l in the paper
-cv::Mat KCFTracker::get_scale_sample(const cv::Mat & image)
+cv::Mat KCFTracker::get_scale_sample(const ImagePyramid & pyramid)
+{
+  KCF_PROFILE_SCOPE(_profile, GET_SCALE_SAMPLE);
+  get_scale_levels(pyramid);
+  return get_scale_spectra();
+}
+
+// Compute the scale levels of F^l before the fft, one column per scale
+cv::Mat KCFTracker::get_scale_levels(const ImagePyramid & pyramid)
 {
-  CvLSVMFeatureMapCaskade *map[n_scales]; // temporarily store FHOG result
-  cv::Mat xsf; // output
-  int totalSize; // # of features
-  cv::Size ssize;
+  cv::Mat &xsf = _ws.xsr; // output, before the fft
 
+  // Size of the FHOG features after normalizeAndTruncate and PCAFeatureMaps, every column gets written below
+  int totalSize = (scale_model_width / cell_size - 2) * (scale_model_height / cell_size - 2) * (3 * NUM_SECTOR + 4); // # of features
+  xsf.create(totalSize, n_scales, CV_32F);
 
-  for(int i = 0; i < n_scales; i++)
+  // The scale levels are independent, split them into stripes that run in parallel
+  int nstripes = scale_threads > 0 ? scale_threads : cv::getNumThreads();
+  nstripes = std::max(1, std::min(nstripes, n_scales));
+
+  while((int)_ws.scale_fhog.size() < nstripes)
   {
-    map[i] = NULL;
+    CvLSVMFeatureWorkspace *fhog;
+    allocFeatureWorkspace(&fhog);
+    _ws.scale_fhog.push_back(fhog);
+    _ws.scale_patch.push_back(cv::Mat());
+    _ws.scale_buffer.push_back(cv::Mat());
+    _ws.scale_grown.push_back(0);
   }
 
-  for(int i = 0; i < n_scales; i++)
+  if(nstripes == 1)
+    ScaleSampleBody(this, pyramid, 1)(cv::Range(0, 1));
+  else if(scale_executor)
+    scale_executor->parallelFor(cv::Range(0, nstripes), ScaleSampleBody(this, pyramid, nstripes), nstripes);
+  else
+    cv::parallel_for_(cv::Range(0, nstripes), ScaleSampleBody(this, pyramid, nstripes), nstripes);
+
+  return xsf;
+}
+
+// Do fft to the scale levels row by row, in the fast scale mode after compressing them with scale_basis
+cv::Mat KCFTracker::get_scale_spectra()
+{
+  if(fast_scale)
+  {
+    cv::gemm(scale_basis, _ws.xsr, 1, cv::noArray(), 0, _ws.xsp);
+    cv::dft(_ws.xsp, _ws.xsf, cv::DFT_ROWS | cv::DFT_COMPLEX_OUTPUT);
+  }
+  else
   {
-    // Size of subwindow waiting to be detect
-    float patch_width = base_width * scaleFactors[i] * currentScaleFactor;
-    float patch_height = base_height * scaleFactors[i] * currentScaleFactor;
+    // Do fft to the FHOG features row by row
+    cv::dft(_ws.xsr, _ws.xsf, cv::DFT_ROWS | cv::DFT_COMPLEX_OUTPUT);
+  }
 
-    float cx = _roi.x + _roi.width / 2.0f;
-    float cy = _roi.y + _roi.height / 2.0f;
+  return _ws.xsf;
+}
 
-    // Get the subwindow
-    cv::Mat im_patch = RectTools::extractImage(image, cx, cy, patch_width, patch_height);
-    cv::Mat im_patch_resized;
+// Recompute scale_basis from the scale model sf_sample, for the fast scale mode. The model has
+// n_scales columns, so its n_scales leading left singular vectors keep all of it.
+void KCFTracker::update_scale_basis()
+{
+  cv::SVD::compute(sf_sample, _ws.scale_w, _ws.scale_u, _ws.scale_vt);
+  cv::transpose(_ws.scale_u, scale_basis);
+}
 
-    ssize = im_patch.size();
+// Compute the F^l in the paper from the last one, after the scale moved by shift levels
+cv::Mat KCFTracker::get_scale_sample(const ImagePyramid & pyramid, int shift)
+{
+  if(_ws.xsr.empty() || std::abs(shift) >= n_scales)
+    return get_scale_sample(pyramid);
 
-    //printf("im_patch_width=%d\n",ssize.width);
-    //printf("im_patch_height=%d\n",ssize.height);
-    
-    if(ssize.width <= 0 || ssize.height <= 0)
-    {
-       continue;     
-    }
+  KCF_PROFILE_SCOPE(_profile, GET_SCALE_SAMPLE);
+
+  // Same scale, the last spectra can be used as they are
+  if(shift == 0)
+    return _ws.xsf;
 
-    // Scaling the subwindow
-    if(scale_model_width > im_patch.cols)
-      resize(im_patch, im_patch_resized, cv::Size(scale_model_width, scale_model_height), 0, 0, 1);
+  // Level i at the new scale is level i + shift at the old one. Walk in the direction that reads
+  // every source level before it is overwritten.
+  int first = shift > 0 ? 0 : n_scales - 1;
+  int step = shift > 0 ? 1 : -1;
+  for(int i = first; i >= 0 && i < n_scales; i += step)
+  {
+    int j = i + shift;
+    cv::Mat column = _ws.xsr.col(i);
+    float hann_j = (j >= 0 && j < n_scales) ? s_hann.at<float>(0, j) : 0.f;
+
+    // The hanning window is zero at the borders, levels taken from there have to be computed again
+    if(s_hann.at<float>(0, i) == 0.f)
+      column.setTo(0);
+    else if(hann_j > 0.f)
+      _ws.xsr.col(j).convertTo(column, CV_32F, s_hann.at<float>(0, i) / hann_j);
     else
-      resize(im_patch, im_patch_resized, cv::Size(scale_model_width, scale_model_height), 0, 0, 3);
+      get_scale_level(pyramid, i, 0);
+  }
 
-    // Compute the FHOG features for the subwindow
-    IplImage im_ipl = im_patch_resized;
-    getFeatureMaps(&im_ipl, cell_size, &map[i]);
-    normalizeAndTruncate(map[i], 0.2f);
-    PCAFeatureMaps(map[i]);
+  return get_scale_spectra();
+}
 
-    if(i == 0)
-    {
-      totalSize = map[i]->numFeatures*map[i]->sizeX*map[i]->sizeY;
-      xsf = cv::Mat(cv::Size(n_scales,totalSize), CV_32F, float(0));
-    }
+void KCFTracker::get_scale_level(const ImagePyramid & pyramid, int i, int stripe)
+{
+  CvLSVMFeatureWorkspace *fhog = _ws.scale_fhog[stripe];
+  cv::Mat column = _ws.xsr.col(i);
 
-    // Multiply the FHOG results by hanning window and copy to the output
-    cv::Mat FeaturesMap = cv::Mat(cv::Size(1, totalSize), CV_32F, map[i]->map);
-    float mul = s_hann.at<float > (0, i);
-    FeaturesMap = mul * FeaturesMap;
-    FeaturesMap.copyTo(xsf.col(i));
+  // Size of subwindow waiting to be detect
+  float patch_width = base_width * scaleFactors[i] * currentScaleFactor;
+  float patch_height = base_height * scaleFactors[i] * currentScaleFactor;
 
-  }
+  float cx = _roi.x + _roi.width / 2.0f;
+  float cy = _roi.y + _roi.height / 2.0f;
 
-  // Free the temp variables
-  for(int i = 0; i < n_scales; i++)
-      freeFeatureMapObject(&map[i]);
+  cv::Size model_size(scale_model_width, scale_model_height);
+  CvLSVMFeatureMapCaskade *map = &fhog->map;
 
-  // Do fft to the FHOG features row by row
-  xsf = FFTTools::fftd(xsf, 0, 1);
+  // Get the subwindow scaled to the model size, from the pyramid level closest to it
+  cv::Mat &im_patch_resized = _ws.scale_patch[stripe];
+  cv::Mat &buffer = _ws.scale_buffer[stripe];
+  uchar *buffer_data = buffer.data;
 
-  return xsf;
+  // Scales whose subwindow is empty stay zero
+  bool sampled = pyramid.extractImage(cx, cy, patch_width, patch_height, model_size, im_patch_resized, buffer);
+  _ws.scale_grown[stripe] += buffer.data != buffer_data;
+  if(!sampled)
+  {
+    column.setTo(0);
+    return;
+  }
+
+  // Compute the FHOG features for the subwindow
+  IplImage im_ipl = im_patch_resized;
+  getFeatureMapsWs(&im_ipl, cell_size, fhog);
+  normalizeAndPCAFeatureMapsWs(fhog, 0.2f, NULL, 0);
+  assert(map->numFeatures * map->sizeX * map->sizeY == _ws.xsr.rows);
+
+  // Multiply the FHOG results by hanning window and copy to the output
+  cv::Mat FeaturesMap = cv::Mat(cv::Size(1, _ws.xsr.rows), CV_32F, map->map);
+  float mul = s_hann.at<float > (0, i);
+  FeaturesMap.convertTo(column, CV_32F, mul);
 }
 
 // Compute the FFT Guassian Peak for scaling
 cv::Mat KCFTracker::computeYsf()
 {
-    float scale_sigma2 = n_scales / std::sqrt(n_scales) * scale_sigma_factor;
+    // The fast scale mode measures the gaussian in interpolated steps, n_interp_scales / n_scales per level
+    int n = fast_scale ? n_interp_scales : n_scales;
+    float levelSteps = fast_scale ? n_interp_scales / (float) n_scales : 1;
+    float scale_sigma2 = n / std::sqrt(n) * scale_sigma_factor;
     scale_sigma2 = scale_sigma2 * scale_sigma2;
     cv::Mat res(cv::Size(n_scales, 1), CV_32F, float(0));
     float ceilS = std::ceil(n_scales / 2.0f);
 
     for(int i = 0; i < n_scales; i++)
     {
-      res.at<float>(0,i) = std::exp(- 0.5 * std::pow(i + 1- ceilS, 2) / scale_sigma2);
+      res.at<float>(0,i) = std::exp(- 0.5 * std::pow((i + 1- ceilS) * levelSteps, 2) / scale_sigma2);
     }
 
     return FFTTools::fftd(res);
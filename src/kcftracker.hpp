@@ -31,6 +31,11 @@ Their values can be customized further before calling init():
     template_size: template size in pixels, 0 to use ROI size
     scale_step: scale step for multi-scale estimation, 1 to disable it
     scale_weight: to downweight detection scores of other scales for added stability
+    scale_threads: threads for the DSST scale samples, 0 for the OpenCV default, 1 to run serially
+    scale_executor: thread pool running the scale sampling stripes instead of cv::parallel_for_, e.g. a WorkStealingPool
+    scale_reuse_sample: train the scale filter on the detection scale sample, shifted by the scale change
+    pyramid_levels: levels of the per-frame pyramid the patches are sampled from, 1 to sample the frame only
+    fast_scale: fDSST scale estimation, n_scales levels (e.g. 17) compressed with PCA, the response interpolated to n_interp_scales
 
 For speed, the value (template_size/cell_size) should be a power of 2 or a product of small prime numbers.
 
@@ -40,6 +45,9 @@ Inputs to init():
 
 Inputs to update():
    image is the current frame.
+   Instead of the frame, init() and update() also take an ImagePyramid built from it. Several trackers
+   running on the same frame can share one pyramid.
+   They also take a FrameView of a frame in the caller's memory (gray, BGR or NV12), without copying it.
 
 Outputs of update():
    cv::Rect with target positions for the current frame
@@ -83,11 +91,26 @@ the use of this software, even if advised of the possibility of such damage.
 #pragma once
 
 #include "tracker.h"
+#include "imagepyramid.hpp"
+#include "featuretensor.hpp"
+#include "trackerprofile.hpp"
+#include "trackerkernels.hpp"
+#include <climits>
+#include <memory>
+#include <vector>
 
 #ifndef _OPENCV_KCFTRACKER_HPP_
 #define _OPENCV_KCFTRACKER_HPP_
 #endif
 
+namespace FFTTools
+{
+class DFTPlan;
+}
+
+struct CvLSVMFeatureWorkspace;
+class ParallelExecutor;
+
 class KCFTracker : public Tracker
 {
 public:
@@ -102,9 +125,87 @@ public:
 
     virtual void init(const cv::Point pt1, const cv:: Point pt2, cv::Mat image);
 
+    // Initialize tracker from the pyramid of the initial frame
+    virtual void init(const cv::Rect &roi, const ImagePyramid &pyramid);
+
     // Update position based on the new frame
     virtual cv::Rect update(cv::Mat image);
 
+    // Update position based on the pyramid of the new frame
+    virtual cv::Rect update(const ImagePyramid &pyramid);
+
+    // Start tracking anew at roi, e.g. to re-acquire a lost target. This only calls init(); it is
+    // init() that reuses the plan, the shared constants and the grow-only buffers when the template
+    // size stays the same, and rebuilds them otherwise.
+    void reinit(const cv::Rect &roi, cv::Mat image);
+    void reinit(const cv::Rect &roi, const ImagePyramid &pyramid);
+
+    // The model as a compact binary blob: the translation and scale filters, the position and scale,
+    // and the parameters and sizes they depend on, in the byte order of this machine
+    std::vector<uchar> snapshot() const;
+
+    // Continue from a snapshot instead of init(), on a tracker constructed with the same features.
+    // Returns false, leaving the tracker unchanged, for a blob that is not such a snapshot: of another
+    // layout or features, with model matrices of other types or sizes than its parameters give, or
+    // with a window that is not finite and of a positive size.
+    bool restore(const std::vector<uchar> &blob);
+
+    // init() and update() on a borrowed frame, read in place. NV12 frames are tracked on their
+    // Y plane; only Lab features need the colors, and then just the translation patch is converted.
+    virtual void init(const cv::Rect &roi, const FrameView &frame);
+    virtual cv::Rect update(const FrameView &frame);
+
+    // Frame region the patches of the next update() are read from, the part of the pyramid update(image)
+    // builds. All of the frame, of any size, before init() or restore().
+    virtual cv::Rect searchRegion() const;
+
+    // Debug aids of builds with KCF_DIAGNOSTICS, combined in diagnostics. Other builds ignore them.
+    enum Diagnostics
+    {
+        DIAG_NONE = 0,
+        DIAG_SHOW_PATCH = 1, // imshow every translation patch
+        DIAG_CHECK_FHOG = 2  // recompute the FHOG maps with calcFeatureMaps and compare
+    };
+    int diagnostics;
+
+    // Translation patches whose FHOG maps differed from calcFeatureMaps, with DIAG_CHECK_FHOG
+    int fhog_mismatches() const { return _fhog_mismatches; }
+
+    // What the last update() computed and which of its stages ran
+    struct UpdateStages
+    {
+        UpdateStages() : peak_value(0), psr(0), scale_detected(false), scale_trained(false), trained(false) {}
+
+        float peak_value;    // peak of the translation response
+        float psr;           // its peak-to-sidelobe ratio, 0 unless adaptive
+        bool scale_detected; // the scale search ran
+        bool scale_trained;  // the scale model was updated
+        bool trained;        // the translation model was updated
+    };
+    const UpdateStages &stages() const { return _stages; }
+
+    // Work of the next update(), estimated from the current position and scale, so that a scheduler
+    // can see the expensive trackers before running them. Counts a full update, with the scale search
+    // and the pyramid update(image) builds. All zero before init() or restore().
+    struct CostEstimate
+    {
+        CostEstimate() : region_pixels(0), pyramid_pixels(0), window_pixels(0), patch_pixels(0), feature_values(0), scale_pixels(0), scale_values(0), total(0) {}
+
+        double region_pixels;  // frame pixels the pyramid levels are built over, see searchRegion()
+        double pyramid_pixels; // pixels the pyramid build reads, four per pixel of every level above 0
+        double window_pixels;  // frame pixels of the translation window
+        double patch_pixels;   // pixels of the resized translation patches, of the detection and the training
+        double feature_values; // translation feature values, of both patches
+        double scale_pixels;   // pixels of the resized scale patches, of the detection and the training
+        double scale_values;   // scale sample values, of both samples
+        double total;          // relative cost in pixel and value operations, for comparing trackers, not a time
+    };
+    CostEstimate estimateCost() const;
+
+    // Time spent in the stages of init() and update(), zero unless built with KCF_PROFILE
+    const TrackerProfile &profile() const { return _profile; }
+    TrackerProfile &profile() { return _profile; }
+
     float interp_factor; // linear interpolation factor for adaptation
     float sigma; // gaussian kernel bandwidth
     float lambda; // regularization
@@ -122,33 +223,66 @@ public:
     float scale_sigma_factor; // bandwidth of gaussian target
     int n_scales; // # of scaling windows
     float scale_lr; // scale learning rate
-    float *scaleFactors; // all scale changing rate, from larger to smaller with 1 to be the middle
+    const float *scaleFactors; // all scale changing rate, from larger to smaller with 1 to be the middle
     int scale_model_width; // the model width for scaling
     int scale_model_height; // the model height for scaling
     float currentScaleFactor; // scaling rate
     float min_scale_factor; // min scaling rate
-    float max_scale_factor; // max scaling rate
+    float max_scale_factor; // max scaling rate, only enforced with bounded_cost
     float scale_lambda; // regularization
+    int scale_threads; // threads computing the scale samples, 0 for the OpenCV default, 1 to run serially
+    ParallelExecutor *scale_executor; // runs the scale sampling stripes, NULL for cv::parallel_for_
+    bool scale_reuse_sample; // build the training scale sample from the detection one, only computing the missing levels
+    int pyramid_levels; // levels of the pyramid built by init(image) and update(image), 1 to sample the frame only
+    bool fast_scale; // sample n_scales levels, compress them with PCA and interpolate the response to n_interp_scales
+    int n_interp_scales; // # of scaling rates the response is interpolated to in the fast scale mode
+    const float *interpScaleFactors; // scale changing rate of every interpolated response bin, in the fast scale mode
+    bool adaptive; // run the scale search and the model updates depending on the detection PSR, see stages()
+    float adaptive_stable_psr; // adaptive: PSR of a strong peak; on consecutive strong frames the scale is only searched every adaptive_scale_interval frames
+    int adaptive_scale_interval;
+    float adaptive_min_psr; // adaptive: frames with a lower PSR update neither the models nor the scale
+    bool bounded_cost; // bound the work of update(): enforce max_scale_factor and max_window_pixels
+    int max_window_pixels; // bounded_cost: max frame pixels of the translation window and of the largest scale patch, 0 for no cap
+    bool half_storage; // keep the template and the scale filter numerator in half precision (see HalfFloat), set before init()
 
 
 protected:
-    // Detect object in the current frame.
-    cv::Point2f detect(cv::Mat z, cv::Mat x, float &peak_value);
+    // Detect object in the current frame. z and x are feature spectra from fftFeatures().
+    // With psr, also computes the peak-to-sidelobe ratio of the response.
+    cv::Point2f detect(cv::Mat zf, cv::Mat xf, float &peak_value, float *psr = NULL);
 
-    // train tracker with a single image
-    void train(cv::Mat x, float train_interp_factor);
+    // Peak-to-sidelobe ratio of the response res with its maximum peak_value at peak
+    float peakToSidelobe(const cv::Mat &res, const cv::Point &peak, float peak_value);
+
+    // Stages of update() after a detection of the given PSR: the model updates with confident, the
+    // scale search and training with search_scale. Counts the strong frames and the frames since
+    // the last scale search of the adaptive mode.
+    void gateStages(float psr, bool &confident, bool &search_scale);
+
+    // train tracker with a single image, given as feature spectra from fftFeatures()
+    void train(cv::Mat xf, float train_interp_factor);
 
     // Evaluates a Gaussian kernel with bandwidth SIGMA for all relative shifts between input images X and Y, which must both be MxN. They must    also be periodic (ie., pre-processed with a cosine window).
-    cv::Mat gaussianCorrelation(cv::Mat x1, cv::Mat x2);
+    // Both inputs are given in the frequency domain, as returned by fftFeatures().
+    cv::Mat gaussianCorrelation(cv::Mat x1f, cv::Mat x2f);
+
+    // Transform every feature channel to the frequency domain. The CCS packed spectra are stacked vertically, one size_patch[0] x size_patch[1] block per channel.
+    cv::Mat fftFeatures(const FeatureTensor & x);
 
     // Create Gaussian Peak. Function called only in the first frame.
     cv::Mat createGaussianPeak(int sizey, int sizex);
 
-    // Obtain sub-window from image, with replication-padding and extract features
-    cv::Mat getFeatures(const cv::Mat & image, bool inithann, float scale_adjust = 1.0f);
+    // Obtain sub-window from image, with replication-padding and extract features, multiplied by the Hanning window
+    const FeatureTensor & getFeatures(const ImagePyramid & pyramid, bool inithann, float scale_adjust = 1.0f);
+
+    // Create the Hanning window of size_patch[0] x size_patch[1]. Function called only in the first frame.
+    cv::Mat createHanningMats();
+
+    // Look up the window and the gaussian peak spectrum of size_patch in the shared cache, computing them on a miss
+    void initConstants();
 
-    // Initialize Hanning window. Function called only in the first frame.
-    void createHanningMats();
+    // Same for ysf, s_hann and the scale factors
+    void initScaleConstants();
 
     // Calculate sub-pixel peak for one dimension
     float subPixelPeak(float left, float center, float right);
@@ -160,40 +294,157 @@ protected:
     cv::Mat createHanningMatsForScale();
 
     // Initialization for scales
-    void dsstInit(const cv::Rect &roi, cv::Mat image);
+    void dsstInit(const cv::Rect &roi, const ImagePyramid & pyramid);
 
     // Compute the F^l in the paper
-    cv::Mat get_scale_sample(const cv::Mat & image);
+    cv::Mat get_scale_sample(const ImagePyramid & pyramid);
+
+    // Compute the scale levels of F^l before the fft, one column per scale
+    cv::Mat get_scale_levels(const ImagePyramid & pyramid);
+
+    // Do fft to the scale levels row by row, in the fast scale mode after compressing them with scale_basis
+    cv::Mat get_scale_spectra();
+
+    // Recompute scale_basis from the scale model sf_sample, for the fast scale mode
+    void update_scale_basis();
+
+    // Compute the F^l in the paper from the last one, after the scale moved by shift levels.
+    // Levels not covered by the last sample are computed, a shift of n_scales or more recomputes all of them.
+    cv::Mat get_scale_sample(const ImagePyramid & pyramid, int shift);
+
+    // Largest currentScaleFactor with bounded_cost, after init() or restore()
+    float scaleLimit() const;
+
+    // BGR colors of the translation patch z of window, for a frame that is not BGR
+    const cv::Mat &colorPatch(const ImagePyramid & pyramid, const cv::Mat & z, const cv::Rect & window);
+
+    // Compute column i of the scale sample, using the FHOG workspace and patch buffers of the given sampling stripe
+    void get_scale_level(const ImagePyramid & pyramid, int i, int stripe);
 
     // Update the ROI size after training
     void update_roi();
 
-    // Train method for scaling
-    void train_scale(cv::Mat image, bool ini = false);
+    // Train method for scaling, reuse_shift is passed to get_scale_sample
+    void train_scale(const ImagePyramid & pyramid, bool ini = false, int reuse_shift = INT_MAX);
 
     // Detect the new scaling rate
-    cv::Point2i detect_scale(cv::Mat image);
+    cv::Point2i detect_scale(const ImagePyramid & pyramid);
 
     cv::Mat _alphaf;
-    cv::Mat _prob;
-    cv::Mat _tmpl;
+    cv::Mat _prob; // shared, read only
+    cv::Mat _tmpl; // template features, kept in the frequency domain (see fftFeatures). CV_16S halves with half_storage.
     cv::Mat _num;
     cv::Mat _den;
     cv::Mat _labCentroids;
+    cv::Mat _labLut; // nearest Lab centroid of every quantized BGR color, see createLabLut()
 
     cv::Mat sf_den;
-    cv::Mat sf_num;
+    cv::Mat sf_num; // CV_16SC2 halves with half_storage
+    cv::Mat sf_sample; // fast scale mode: running average of the scale levels
+    cv::Mat scale_basis; // fast scale mode: PCA projection of the scale levels, one basis vector per row
 
 private:
     int size_patch[3];
-    cv::Mat hann;
+    cv::Mat hann; // size_patch[0] x size_patch[1], applied to every feature channel. Shared, read only.
     cv::Size _tmpl_sz;
     float _scale;
     int _gaussian_size;
     bool _hogfeatures;
     bool _labfeatures;
 
-    cv::Mat s_hann;
-    cv::Mat ysf;
+    cv::Mat s_hann; // shared, read only
+    cv::Mat ysf;    // 1 x n_scales spectrum, applied to every row of the scale samples. Shared, read only.
+
+    // Constants shared with the other trackers of the same sizes and parameters, see ConstantCache
+    struct TranslationConstants
+    {
+        cv::Mat hann;
+        cv::Mat prob;
+    };
+    struct ScaleConstants
+    {
+        cv::Mat ysf;
+        cv::Mat s_hann;
+        std::vector<float> scaleFactors;
+        std::vector<float> interpScaleFactors;
+    };
+    std::shared_ptr<const TranslationConstants> _translation_constants;
+    std::shared_ptr<const ScaleConstants> _scale_constants;
+
+    class ScaleSampleBody; // runs get_scale_level over a stripe of the scales
+
+    FFTTools::DFTPlan *_dft_plan; // transforms of size_patch[0] x size_patch[1], planned in init()
+
+    // Intermediate buffers of init() and update(). They get their sizes during init() and the
+    // first update(), and are reused afterwards, so the steady state does no heap allocations.
+    // Matrices returned by getFeatures, fftFeatures, gaussianCorrelation and get_scale_sample
+    // live here and are only valid until the next call of the same function.
+    struct Workspace
+    {
+        ImagePyramid pyramid;         // pyramid of the frame given to init(image) or update(image)
+        CvLSVMFeatureWorkspace *fhog; // FHOG maps and scratch buffers
+        cv::Mat border;               // grow-only storage for sampling the translation patch
+        int grown;                    // number of times border, or another grow-only buffer, had to grow
+        cv::Mat resized;              // subwindow resized to _tmpl_sz
+        cv::Mat gray;
+        cv::Mat frame_bgr;            // grow-only storage of color_window
+        cv::Mat frame_yuv;            // grow-only storage of the NV12 planes of the window, gathered for the conversion
+        cv::Mat color_window;         // NV12 frames: the window around the translation patch, converted to BGR
+        cv::Mat color_border;         // grow-only sampler storage for the patch of color_window
+        cv::Mat color;                // BGR translation patch for the Lab features, of frames without colors
+        FeatureTensor features;       // windowed features, one plane per channel (gray: the image itself)
+        cv::Mat xf;                   // feature spectra
+        cv::Mat cf;                   // summed cross-power spectrum
+        cv::Mat model_row;            // half_storage: grow-only buffer of one row of _tmpl, converted to floats
+        cv::Mat c;                    // cross-correlation
+        cv::Mat k;                    // kernel correlation
+        cv::Mat kf;
+        cv::Mat res;                  // detection response
+        cv::Mat alphaf;
+        std::vector<CvLSVMFeatureWorkspace*> scale_fhog; // one FHOG workspace per scale sampling stripe
+        std::vector<cv::Mat> scale_patch; // scale subwindows resized to the scale model size, one per stripe
+        std::vector<cv::Mat> scale_buffer; // grow-only sampler storage, one per stripe
+        std::vector<int> scale_grown;     // number of times each scale_buffer had to grow
+        cv::Mat xsr;                  // scale sample, one column per scale
+        cv::Mat xsf;                  // row-wise spectra of xsr
+        cv::Mat xsp;                  // fast scale: xsr compressed with scale_basis
+        cv::Mat sf_sample_f;          // fast scale: row-wise spectra of the compressed sf_sample
+        cv::Mat scale_w;              // fast scale: SVD of sf_sample
+        cv::Mat scale_u;
+        cv::Mat scale_vt;
+        cv::Mat scale_interp;         // fast scale: response spectrum interpolated to n_interp_scales
+        cv::Mat scale_prod;
+        cv::Mat scale_row;            // half_storage: one row of sf_num, converted to floats
+        cv::Mat add_temp;
+        cv::Mat scale_den;
+        cv::Mat scale_response;
+        cv::Mat new_sf_num;
+        cv::Mat new_sf_den_full;
+        cv::Mat new_sf_den_sum;
+        cv::Mat new_sf_den;
+    } _ws;
+
+    bool _initialized; // by init() or restore(), there is a model to update
+    int _updates; // calls of update() since init() or restore()
+#ifdef KCF_CHECK_ALLOCATIONS
+    // Allocations and grow-only buffer growth at the start of the current update, taken before
+    // update(image) and update(frame) build the pyramid, so that the build is checked as well
+    long _check_mats;
+    int _check_fhog;
+    int _check_grown;
+    bool _check_started;
+    int grownBuffers() const;
+    void startAllocationCheck();
+#endif
+    cv::Size _frame_size; // of the last init() or update(), empty after restore()
+    int _strong_frames; // adaptive: consecutive frames up to the last one with a strong peak
+    int _frames_since_scale; // adaptive: frames since the last scale search
+    UpdateStages _stages;
+
+    TrackerProfile _profile;
+    int _fhog_mismatches;
 
+    // Not copyable, it owns _dft_plan and the FHOG workspaces; the state is copied with snapshot() and restore()
+    KCFTracker(const KCFTracker &);
+    KCFTracker &operator=(const KCFTracker &);
 };
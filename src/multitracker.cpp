@@ -0,0 +1,130 @@
+#include "multitracker.hpp"
+#include "kcftracker.hpp"
+
+// Updates a range of targets, each one only touches its own tracker and position
+class MultiTracker::UpdateBody : public cv::ParallelLoopBody
+{
+public:
+    UpdateBody(MultiTracker *multi) : _multi(multi) {}
+
+    virtual void operator()(const cv::Range &range) const
+    {
+        for (int i = range.start; i < range.end; i++)
+            *_multi->_order_rois[i] = _multi->_order[i]->update(_multi->_pyramid);
+    }
+
+private:
+    MultiTracker *_multi;
+};
+
+MultiTracker::MultiTracker(bool hog, bool fixed_window, bool multiscale, bool lab)
+    : _hog(hog), _fixed_window(fixed_window), _multiscale(multiscale), _lab(lab)
+{
+    pyramid_levels = 8;
+}
+
+MultiTracker::~MultiTracker()
+{
+    for (std::map<int, Tracker *>::iterator it = _targets.begin(); it != _targets.end(); ++it)
+        delete it->second;
+}
+
+Tracker *MultiTracker::createTracker()
+{
+    KCFTracker *tracker = new KCFTracker(_hog, _fixed_window, _multiscale, _lab);
+    // The targets already keep all threads busy
+    tracker->scale_threads = 1;
+    return tracker;
+}
+
+void MultiTracker::addTarget(int id, const cv::Rect &roi)
+{
+    remove(id);
+
+    Tracker *tracker = createTracker();
+    tracker->init(roi, _pyramid);
+    _targets[id] = tracker;
+    _rois[id] = roi;
+}
+
+void MultiTracker::add(int id, const cv::Rect &roi, const cv::Mat &frame)
+{
+    _pyramid.build(frame, pyramid_levels);
+    addTarget(id, roi);
+    _order.clear();
+}
+
+void MultiTracker::add(const std::map<int, cv::Rect> &rois, const cv::Mat &frame)
+{
+    _pyramid.build(frame, pyramid_levels);
+    for (std::map<int, cv::Rect>::const_iterator it = rois.begin(); it != rois.end(); ++it)
+        addTarget(it->first, it->second);
+    _order.clear();
+}
+
+bool MultiTracker::remove(int id)
+{
+    std::map<int, Tracker *>::iterator it = _targets.find(id);
+    if (it == _targets.end())
+        return false;
+
+    delete it->second;
+    _targets.erase(it);
+    _rois.erase(id);
+    _order.clear();
+    return true;
+}
+
+const std::map<int, cv::Rect> &MultiTracker::update(const cv::Mat &frame)
+{
+    if (_targets.empty())
+        return _rois;
+
+    // Only the pyramid is shared, the trackers filter and convert their own patches
+    _pyramid.build(frame, searchRegion(frame.size()), pyramid_levels);
+    return updateTargets();
+}
+
+const std::map<int, cv::Rect> &MultiTracker::update(const FrameView &frame)
+{
+    if (_targets.empty())
+        return _rois;
+
+    cv::Rect region = searchRegion(cv::Size(frame.width, frame.height));
+    _pyramid.build(frame, region, pyramid_levels);
+
+    // The Lab features of NV12 frames need colors, converted once for all targets
+    if (_hog && _lab && frame.format == FrameView::NV12)
+        _pyramid.convertColors(region);
+    return updateTargets();
+}
+
+cv::Rect MultiTracker::searchRegion(const cv::Size &size) const
+{
+    cv::Rect frame(cv::Point(0, 0), size), region;
+    for (std::map<int, Tracker *>::const_iterator it = _targets.begin(); it != _targets.end(); ++it) {
+        cv::Rect r = it->second->searchRegion() & frame;
+        region = region.area() > 0 ? region | r : r;
+    }
+    return region;
+}
+
+const std::map<int, cv::Rect> &MultiTracker::updateTargets()
+{
+    // The map nodes do not move, so the flat view stays valid until the next add() or remove()
+    if (_order.empty())
+    {
+        _order_rois.clear();
+        for (std::map<int, Tracker *>::iterator it = _targets.begin(); it != _targets.end(); ++it)
+        {
+            _order.push_back(it->second);
+            _order_rois.push_back(&_rois[it->first]);
+        }
+    }
+
+    // One stripe per target, so that idle threads pick up the next one while a large target is still running
+    int n = (int) _order.size();
+    cv::parallel_for_(cv::Range(0, n), UpdateBody(this), n);
+
+    return _rois;
+}
@@ -0,0 +1,90 @@
+/*
+Tracker for many targets in the same video.
+
+Every target gets its own Tracker (a KCFTracker by default, see createTracker()). update() builds
+one ImagePyramid of the frame, which all the trackers sample their patches from, then updates the
+targets in parallel on the OpenCV thread pool and returns all of their positions at once. The
+targets are independent, so the update scales with the number of cores as long as there are
+several targets per thread; the number of threads is the OpenCV one (cv::setNumThreads).
+
+The coarser pyramid levels only cover the region the targets read their patches from, the union of
+their search regions. For the Lab features of NV12 frames, that region is also converted to BGR
+once, and every target samples its translation patch from the shared colors. That gives the colors
+of converting the window around its patch itself, except that an enlarged patch blends in the frame
+pixels just outside its window, as it does on BGR frames, instead of its edge. The rest runs per
+target on its resized patches: the gradients of the FHOG features, and the gray conversion of gray
+features on color frames. Those are computed after the patch is resized to the target's template,
+so computing them once over the frame would change the features.
+
+Usage:
+    MultiTracker tracker;
+    tracker.add(rois, frame);
+    for each next frame:
+        const std::map<int, cv::Rect> &rois = tracker.update(frame);
+*/
+
+#pragma once
+
+#include "tracker.h"
+#include "imagepyramid.hpp"
+#include <map>
+#include <vector>
+
+class MultiTracker
+{
+public:
+    // Constructor, the parameters are the ones of the KCFTracker of each target
+    MultiTracker(bool hog = true, bool fixed_window = true, bool multiscale = true, bool lab = true);
+
+    virtual ~MultiTracker();
+
+    // Start tracking a target with the caller's id at roi in frame. An existing target with that id is replaced.
+    void add(int id, const cv::Rect &roi, const cv::Mat &frame);
+
+    // Same for several targets on the same frame, sharing its pyramid
+    void add(const std::map<int, cv::Rect> &rois, const cv::Mat &frame);
+
+    // Stop tracking a target, returns false if there is none with that id
+    bool remove(int id);
+
+    // Update all targets on the new frame, returns their positions by id
+    const std::map<int, cv::Rect> &update(const cv::Mat &frame);
+
+    // Same on a borrowed frame, read in place. For the Lab features of an NV12 frame, the trackers only
+    // convert their translation patches to BGR.
+    const std::map<int, cv::Rect> &update(const FrameView &frame);
+
+    // Positions of all targets after the last add() or update()
+    const std::map<int, cv::Rect> &rois() const { return _rois; }
+
+    int size() const { return (int) _targets.size(); }
+
+    int pyramid_levels; // levels of the shared frame pyramid, 1 to sample the frame only
+
+protected:
+    // Create the tracker of a new target, before it is initialized. The trackers run in parallel
+    // with each other, so they should not start threads of their own.
+    virtual Tracker *createTracker();
+
+    bool _hog, _fixed_window, _multiscale, _lab;
+
+private:
+    class UpdateBody;
+
+    // Start tracking a target on the frame of _pyramid
+    void addTarget(int id, const cv::Rect &roi);
+
+    // Update all targets on the frame of _pyramid
+    const std::map<int, cv::Rect> &updateTargets();
+
+    // Union of the search regions of the targets, inside a frame of size size
+    cv::Rect searchRegion(const cv::Size &size) const;
+
+    std::map<int, Tracker *> _targets;
+    std::map<int, cv::Rect> _rois;
+    ImagePyramid _pyramid;
+
+    // Flat view of the targets for the parallel update
+    std::vector<Tracker *> _order;
+    std::vector<cv::Rect *> _order_rois;
+};
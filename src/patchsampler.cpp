@@ -0,0 +1,223 @@
+#include "patchsampler.hpp"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+// Filter of one output axis: output pixel d is the sum of weight[t] * source[index[t]] over t in start[d] .. start[d + 1] - 1
+struct Taps
+{
+    int *start;
+    int *index;
+    float *weight;
+};
+
+// Upper bound of the taps of out pixels over length source pixels
+int maxTaps(int length, int out, bool area)
+{
+    return area ? out * ((length + out - 1) / out + 1) : 2 * out;
+}
+
+inline int clampIndex(int i, int size)
+{
+    return std::min(std::max(i, 0), size - 1);
+}
+
+// Taps over the source pixels origin .. origin + length - 1 of an axis of size pixels, scaled by stride
+void buildTaps(Taps &taps, int origin, int length, int size, int out, bool area, int stride)
+{
+    double scale = length / (double) out;
+    int n = 0;
+    for (int d = 0; d < out; d++) {
+        taps.start[d] = n;
+        if (area) {
+            // The source pixels overlapping [a, b), weighted by the overlap
+            double a = d * scale, b = a + scale;
+            for (int k = (int) floor(a); k < b; k++) {
+                float w = (float) ((std::min(b, k + 1.0) - std::max(a, (double) k)) / scale);
+                if (w <= 1e-6f)
+                    continue;
+                taps.index[n] = clampIndex(origin + k, size) * stride;
+                taps.weight[n++] = w;
+            }
+        }
+        else {
+            // Pixel centers map to pixel centers, like cv::resize
+            double s = (d + 0.5) * scale - 0.5;
+            int k = (int) floor(s);
+            float f = (float) (s - k);
+            taps.index[n] = clampIndex(origin + k, size) * stride;
+            taps.weight[n++] = 1.f - f;
+            if (f > 0) {
+                taps.index[n] = clampIndex(origin + k + 1, size) * stride;
+                taps.weight[n++] = f;
+            }
+        }
+    }
+    taps.start[out] = n;
+}
+
+// Horizontal pass over one source row, out pixels of cn channels
+template <int cn>
+void filterRow(const uchar *src, const Taps &x, int out, float *dst)
+{
+    for (int d = 0; d < out; d++, dst += cn) {
+        float sum[cn];
+        for (int c = 0; c < cn; c++)
+            sum[c] = 0;
+        for (int t = x.start[d]; t < x.start[d + 1]; t++) {
+            const uchar *p = src + x.index[t];
+            float w = x.weight[t];
+            for (int c = 0; c < cn; c++)
+                sum[c] += w * p[c];
+        }
+        for (int c = 0; c < cn; c++)
+            dst[c] = sum[c];
+    }
+}
+
+// dst = w * src, or dst += w * src with accumulate
+void blendRow(const float *src, float w, float *dst, int n, bool accumulate)
+{
+    int i = 0;
+#if defined(__AVX__)
+    __m256 vw = _mm256_set1_ps(w);
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(vw, _mm256_loadu_ps(src + i));
+        if (accumulate)
+            v = _mm256_add_ps(v, _mm256_loadu_ps(dst + i));
+        _mm256_storeu_ps(dst + i, v);
+    }
+#elif defined(__SSE2__)
+    __m128 vw = _mm_set1_ps(w);
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_mul_ps(vw, _mm_loadu_ps(src + i));
+        if (accumulate)
+            v = _mm_add_ps(v, _mm_loadu_ps(dst + i));
+        _mm_storeu_ps(dst + i, v);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t vw = vdupq_n_f32(w);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vmulq_f32(vw, vld1q_f32(src + i));
+        if (accumulate)
+            v = vaddq_f32(v, vld1q_f32(dst + i));
+        vst1q_f32(dst + i, v);
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = accumulate ? dst[i] + w * src[i] : w * src[i];
+}
+
+// Round the non-negative sums to the 8 bit output, the vector and scalar paths round the same way
+void storeRow(const float *src, uchar *dst, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(src + i), half));
+        __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(src + i + 4), half));
+        __m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(src + i + 8), half));
+        __m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(src + i + 12), half));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    for (; i + 8 <= n; i += 8) {
+        uint32x4_t a = vcvtq_u32_f32(vaddq_f32(vld1q_f32(src + i), half));
+        uint32x4_t b = vcvtq_u32_f32(vaddq_f32(vld1q_f32(src + i + 4), half));
+        vst1_u8(dst + i, vqmovn_u16(vcombine_u16(vqmovn_u32(a), vqmovn_u32(b))));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = (uchar) std::min((int) (src[i] + 0.5f), 255);
+}
+
+template <int cn>
+void sampleImage(const cv::Mat &in, const Taps &x, const Taps &y, const cv::Size &size, float *rows[2], float *acc, cv::Mat &out)
+{
+    int n = size.width * cn;
+
+    // The last two filtered source rows, consecutive output rows mostly share one
+    int cached[2] = {-1, -1};
+    int next = 0;
+
+    for (int d = 0; d < size.height; d++) {
+        for (int t = y.start[d]; t < y.start[d + 1]; t++) {
+            int sy = y.index[t];
+            const float *row;
+            if (sy == cached[0])
+                row = rows[0];
+            else if (sy == cached[1])
+                row = rows[1];
+            else {
+                filterRow<cn>(in.ptr<uchar>(sy), x, size.width, rows[next]);
+                cached[next] = sy;
+                row = rows[next];
+                next ^= 1;
+            }
+            blendRow(row, y.weight[t], acc, n, t > y.start[d]);
+        }
+        storeRow(acc, out.ptr<uchar>(d), n);
+    }
+}
+
+}
+
+bool PatchSampler::supported(const cv::Mat &in)
+{
+    return in.type() == CV_8UC1 || in.type() == CV_8UC3;
+}
+
+bool PatchSampler::sample(const cv::Mat &in, const cv::Rect &window, const cv::Size &size, int interpolation, cv::Mat &out, cv::Mat &buffer)
+{
+    if (!supported(in) || in.empty() || window.width <= 0 || window.height <= 0 || size.width <= 0 || size.height <= 0)
+        return false;
+    if (interpolation != cv::INTER_LINEAR && interpolation != cv::INTER_AREA)
+        return false;
+
+    int cn = in.channels();
+    bool area_x = interpolation == cv::INTER_AREA && window.width > size.width;
+    bool area_y = interpolation == cv::INTER_AREA && window.height > size.height;
+    int taps_x = maxTaps(window.width, size.width, area_x);
+    int taps_y = maxTaps(window.height, size.height, area_y);
+
+    // Tables and rows, all 4 byte values
+    size_t values = (size.width + 1) + 2 * (size_t) taps_x + (size.height + 1) + 2 * (size_t) taps_y + 3 * (size_t) size.width * cn;
+    if (buffer.total() * buffer.elemSize() < values * 4)
+        buffer.create(1, (int) (values * 4), CV_8U);
+
+    int *p = (int *) buffer.data;
+    Taps x, y;
+    x.start = p;
+    x.index = x.start + size.width + 1;
+    x.weight = (float *) (x.index + taps_x);
+    y.start = (int *) (x.weight + taps_x);
+    y.index = y.start + size.height + 1;
+    y.weight = (float *) (y.index + taps_y);
+    float *rows[2];
+    rows[0] = y.weight + taps_y;
+    rows[1] = rows[0] + size.width * cn;
+    float *acc = rows[1] + size.width * cn;
+
+    buildTaps(x, window.x, window.width, in.cols, size.width, area_x, cn);
+    buildTaps(y, window.y, window.height, in.rows, size.height, area_y, 1);
+
+    out.create(size, in.type());
+    if (cn == 1)
+        sampleImage<1>(in, x, y, size, rows, acc, out);
+    else
+        sampleImage<3>(in, x, y, size, rows, acc, out);
+    return true;
+}
@@ -0,0 +1,25 @@
+/*
+Crop, border replication and resize of a patch in one pass.
+
+sample() maps every pixel of the output straight to the source window, which may reach
+outside of the image: the source coordinates are clamped, which replicates the border like
+BORDER_REPLICATE. Each output axis is filtered bilinearly, or with a box filter over the
+covered source pixels (like INTER_AREA) when it shrinks and area filtering was asked for.
+Nothing is allocated once the buffers are large enough, the rows are blended and stored
+with SSE2 / AVX or NEON where available.
+*/
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+namespace PatchSampler
+{
+// True for the images sample() handles: 8 bit gray or BGR
+bool supported(const cv::Mat &in);
+
+// Resample window of in (in its coordinates, clamped to the image) to size, with INTER_LINEAR or
+// INTER_AREA, into out. buffer holds the filter tables and rows, out and buffer only grow.
+// Returns false, doing nothing, for images or interpolations it does not handle.
+bool sample(const cv::Mat &in, const cv::Rect &window, const cv::Size &size, int interpolation, cv::Mat &out, cv::Mat &buffer);
+}
@@ -128,6 +128,29 @@ inline cv::Mat subwindow(const cv::Mat &in, const cv::Rect & window, int borderT
 }
 
 
+// Same as subwindow, but a window that needs border replication is written into buffer.
+// buffer only grows, so windows of the same or a smaller size reuse its memory.
+inline cv::Mat subwindow(const cv::Mat &in, const cv::Rect & window, int borderType, cv::Mat &buffer)
+{
+    cv::Rect cutWindow = window;
+    RectTools::limit(cutWindow, in.cols, in.rows);
+    if (cutWindow.height <= 0 || cutWindow.width <= 0)assert(0);
+    cv::Rect border = RectTools::getBorder(window, cutWindow);
+    cv::Mat res = in(cutWindow);
+
+    if (border != cv::Rect(0, 0, 0, 0))
+    {
+        size_t bytes = (size_t) window.width * window.height * in.elemSize();
+        if (buffer.total() * buffer.elemSize() < bytes)
+            buffer.create(1, (int) bytes, CV_8U);
+        cv::Mat dst(window.height, window.width, in.type(), buffer.data);
+        cv::copyMakeBorder(res, dst, border.y, border.height, border.x, border.width, borderType);
+        res = dst;
+    }
+    return res;
+}
+
+
 inline void cutOutsize(float &num, int limit)
 {
   if(num < 0)
@@ -136,7 +159,8 @@ inline void cutOutsize(float &num, int limit)
     num = limit - 1;
 }
 
-inline cv::Mat extractImage(const cv::Mat &in, float cx, float cy, float patch_width, float patch_height)
+// Rectangle of in that extractImage returns
+inline cv::Rect extractRect(const cv::Mat &in, float cx, float cy, float patch_width, float patch_height)
 {
 
     float xs_s = floor(cx) - floor(patch_width / 2);
@@ -152,7 +176,12 @@ inline cv::Mat extractImage(const cv::Mat &in, float cx, float cy, float patch_w
     RectTools::cutOutsize(ys_e, in.rows);
 
 
-    return in(cv::Rect(xs_s, ys_s, xs_e - xs_s, ys_e - ys_s));
+    return cv::Rect(xs_s, ys_s, xs_e - xs_s, ys_e - ys_s);
+}
+
+inline cv::Mat extractImage(const cv::Mat &in, float cx, float cy, float patch_width, float patch_height)
+{
+    return in(extractRect(in, cx, cy, patch_width, patch_height));
 }
 
 inline cv::Mat getGrayImage(cv::Mat img)
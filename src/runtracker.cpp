@@ -9,8 +9,14 @@
 
 #include "kcftracker.hpp"
 
+#include "spscqueue.hpp"
+
 #include <dirent.h>
 #include <sys/time.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <thread>
 #include "json/json.h"
 
 #define CONFIG_FILENAME "../src/config.json"
@@ -36,6 +42,18 @@ struct sys_config
     bool lab;
     float  scale_step; 
     int  num_scales;
+    bool fast_scale;
+    int  num_interp_scales;
+    int  scale_threads;
+    bool scale_reuse_sample;
+    int  pyramid_levels;
+    bool adaptive;
+    float adaptive_stable_psr;
+    int  adaptive_scale_interval;
+    float adaptive_min_psr;
+    bool half_storage;
+    bool bounded_cost;
+    int  max_window_pixels;
 };
 
 
@@ -93,6 +111,18 @@ bool parse_config(char * path, sys_config & config)
 
     config.scale_step = root["scale step"].asFloat();
     config.num_scales = root["num scales"].asInt();
+    config.fast_scale = root["fast scale"].asInt();
+    config.num_interp_scales = root.get("num interp scales", 33).asInt();
+    config.scale_threads = root["scale threads"].asInt();
+    config.scale_reuse_sample = root["scale reuse sample"].asInt();
+    config.pyramid_levels = root.get("pyramid levels", 8).asInt();
+    config.adaptive = root.get("adaptive", 0).asInt();
+    config.adaptive_stable_psr = root.get("adaptive stable psr", 20).asFloat();
+    config.adaptive_scale_interval = root.get("adaptive scale interval", 5).asInt();
+    config.adaptive_min_psr = root.get("adaptive min psr", 7).asFloat();
+    config.half_storage = root.get("half storage", 0).asInt();
+    config.bounded_cost = root.get("bounded cost", 0).asInt();
+    config.max_window_pixels = root.get("max window pixels", 0).asInt();
 
     ifs.close();
         return true;
@@ -127,6 +157,14 @@ int main(int argc, char* argv[]){
 
         std::cout <<"scale step = "<<config.scale_step<<std::endl;
         std::cout <<"num scales = "<<config.num_scales<<std::endl;
+        std::cout <<"fast scale = "<<config.fast_scale<<std::endl;
+        std::cout <<"num interp scales = "<<config.num_interp_scales<<std::endl;
+        std::cout <<"scale threads = "<<config.scale_threads<<std::endl;
+        std::cout <<"scale reuse sample = "<<config.scale_reuse_sample<<std::endl;
+        std::cout <<"pyramid levels = "<<config.pyramid_levels<<std::endl;
+        std::cout <<"adaptive = "<<config.adaptive<<std::endl;
+        std::cout <<"half storage = "<<config.half_storage<<std::endl;
+        std::cout <<"bounded cost = "<<config.bounded_cost<<std::endl;
     }
     else
     {
@@ -161,6 +199,18 @@ int main(int argc, char* argv[]){
 
         tracker.scale_step = config.scale_step;
         tracker.n_scales   = config.num_scales;
+        tracker.fast_scale = config.fast_scale;
+        tracker.n_interp_scales = config.num_interp_scales;
+        tracker.scale_threads = config.scale_threads;
+        tracker.scale_reuse_sample = config.scale_reuse_sample;
+        tracker.pyramid_levels = config.pyramid_levels;
+        tracker.adaptive = config.adaptive;
+        tracker.adaptive_stable_psr = config.adaptive_stable_psr;
+        tracker.adaptive_scale_interval = config.adaptive_scale_interval;
+        tracker.adaptive_min_psr = config.adaptive_min_psr;
+        tracker.half_storage = config.half_storage;
+        tracker.bounded_cost = config.bounded_cost;
+        tracker.max_window_pixels = config.max_window_pixels;
 
 	//New window
 	string window_name = "video | q or esc to quit";
@@ -265,31 +315,78 @@ int main(int argc, char* argv[]){
 
 #else
 
+// One frame on its way through the pipeline, an empty image ends the sequence
+struct FrameItem
+{
+	FrameItem() : index(0) {}
+
+	int index;
+	cv::Mat image;
+	cv::Rect roi; // tracker result
+};
+
+// Decoder stage: reads the images of the sequence ahead of the tracker
+static void decodeFrames(std::string imgPath, SpscQueue<FrameItem> *frames)
+{
+	char name[16];
+	for (int count = 1; ; count++)
+	{
+		sprintf(name, "%04d", count);
+		std::string imgFinalPath = imgPath + "img/" + std::string(name) + ".jpg";
+
+		FrameItem item;
+		item.index = count;
+		item.image = cv::imread(imgFinalPath, IMREAD_GRAYSCALE);
+		if (item.image.empty())
+			printf("Failed to open image: %s\n", imgFinalPath.c_str());
+
+		frames->push(item);
+		if (item.image.empty())
+			break;
+	}
+}
+
+// Output stage: writes the results and, unless headless, draws them
+static void outputFrames(SpscQueue<FrameItem> *results, bool headless)
+{
+	std::ofstream resultsFile("output.txt");
+	FrameItem item;
+	for (;;)
+	{
+		results->pop(item);
+		if (item.image.empty())
+			break;
+
+		const cv::Rect &r = item.roi;
+		resultsFile << r.x << "," << r.y << "," << r.width << "," << r.height << "\n";
 
+		if (!headless)
+		{
+			// The tracker is done with the frame, it can be drawn on
+			cv::rectangle(item.image, r, cv::Scalar(0, 255, 0));
+			cv::imshow("windows", item.image);
+			cv::waitKey(1);
+		}
+	}
+}
 
 int main(int argc, char* argv[]){
 
-	if (argc > 5) return -1;
-	
-	if (argc != 2) {
-		printf("usage: %s path\n", argv[0]);
+	if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "show") != 0)) {
+		printf("usage: %s path [show]\n", argv[0]);
 		return -1;
 	}
 
 	bool HOG = true;
 	bool FIXEDWINDOW = false;
 	bool MULTISCALE = true;
-	bool SILENT = true;
+	bool SILENT = argc < 3; // headless unless "show" is given, without any display calls
 	bool LAB = false;
 	// Create KCFTracker object
 	KCFTracker tracker(HOG, FIXEDWINDOW, MULTISCALE, LAB);
 
 	// DSSTTracker tracker;
 
-	int count = 1;
-	cv::Mat processImg;
-	char name[7];
-	std::string imgName;
 	std::string imgPath = argv[1];//"../Bird1/";
 
 	//get init target box params from information file
@@ -309,50 +406,53 @@ int main(int argc, char* argv[]){
 	cv::Rect initRect = cv::Rect(initX, initY, initWidth, initHegiht);
   printf("(%d %d %d %d)\n", (int)initX, (int)initY, (int)initWidth, (int)initHegiht);
 
+	// decode -> track -> output, the stages only meet at the queues
+	SpscQueue<FrameItem> frames(8);
+	SpscQueue<FrameItem> results(64);
+	std::thread decoder(decodeFrames, imgPath, &frames);
+	std::thread output(outputFrames, &results, SILENT);
+
+	// Results the output stage has no room for yet, the tracker never waits for it
+	std::deque<FrameItem> pending;
+
 	double duration = 0;
+	int count = 0;
+	FrameItem item;
 	for (;;)
 	{
-		auto t_start = clock();
-		sprintf(name, "%04d", count);
-		std::string imgFinalPath = imgPath + "img/" + std::string(name) + ".jpg";
-		std::cout << imgFinalPath << std::endl;
-		processImg = cv::imread(imgFinalPath, IMREAD_GRAYSCALE);
-   // processImg = cv::imread(imgFinalPath);
-
-		//processImg = cv::imread(imgFinalPath, CV_LOAD_IMAGE_COLOR);
-
-		if (processImg.empty())
-		{
-			printf("Failed to open image: %s\n", imgFinalPath.c_str());
+		frames.pop(item);
+		if (item.image.empty())
 			break;
-		}
-    
-		cv::Rect showRect;
-		if (count == 1)
+
+		std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+		if (item.index == 1)
 		{
-			tracker.init(initRect, processImg);
-			showRect = initRect;
+			tracker.init(initRect, item.image);
+			item.roi = initRect;
 		}
 		else{
-			showRect = tracker.update(processImg);
-			// printf( "rect (w h): %d %d \n" , showRect.width, showRect.height);
+			item.roi = tracker.update(item.image);
+			// printf( "rect (w h): %d %d \n" , item.roi.width, item.roi.height);
 		}
-		auto t_end = clock();
-		duration += (double)(t_end - t_start) / CLOCKS_PER_SEC;
-		// cout << "all duration: " << duration << "\n";
-
-		cv::rectangle(processImg, showRect, cv::Scalar(0, 255, 0));
-
-		cv::imshow("windows", processImg);
-		cv::waitKey(1);
+		duration += std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
 		count++;
-    if (count >= 1)
-      break;
- 
+
+		pending.push_back(item);
+		while (!pending.empty() && results.tryPush(pending.front()))
+			pending.pop_front();
 	}
-	std::cout << "FPS: " <<count / duration << "\n";
 
-	waitKey();
+	for (; !pending.empty(); pending.pop_front())
+		results.push(pending.front());
+	results.push(FrameItem());
+
+	decoder.join();
+	output.join();
+
+	std::cout << "FPS: " << count / duration << "\n";
+
+	if (!SILENT)
+		waitKey();
 //	system("pause");
 	return 0;
 
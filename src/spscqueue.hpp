@@ -0,0 +1,62 @@
+/*
+Bounded lock-free queue between one producer and one consumer thread.
+
+The slots form a ring, the producer only writes the tail index and the consumer only the head,
+so neither ever takes a lock. tryPush() and tryPop() return immediately; push() and pop() spin
+(yielding the core) until they succeed, for the stages that have nothing else to do.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+template <typename T>
+class SpscQueue
+{
+public:
+    // Queue of at most capacity items
+    explicit SpscQueue(size_t capacity) : _items(capacity + 1), _head(0), _tail(0) {}
+
+    // Producer: append item, false if the queue is full
+    bool tryPush(const T &item)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % _items.size();
+        if (next == _head.load(std::memory_order_acquire))
+            return false;
+        _items[tail] = item;
+        _tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: take the oldest item, false if the queue is empty
+    bool tryPop(T &item)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+        item = _items[head];
+        _items[head] = T(); // do not keep what the item refers to alive in the queue
+        _head.store((head + 1) % _items.size(), std::memory_order_release);
+        return true;
+    }
+
+    void push(const T &item)
+    {
+        while (!tryPush(item))
+            std::this_thread::yield();
+    }
+
+    void pop(T &item)
+    {
+        while (!tryPop(item))
+            std::this_thread::yield();
+    }
+
+private:
+    std::vector<T> _items; // one slot stays free to tell a full queue from an empty one
+    std::atomic<size_t> _head;
+    std::atomic<size_t> _tail;
+};
@@ -19,7 +19,10 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <climits>
 #include <string>
+#include "imagepyramid.hpp"
+#include "frameview.hpp"
 
 class Tracker
 {
@@ -30,6 +33,29 @@ public:
     virtual void init(const cv::Rect &roi, cv::Mat image) = 0;
     virtual cv::Rect  update( cv::Mat image)=0;
 
+    // Same as above from a pyramid of the frame, shared with the other trackers on that frame.
+    // Trackers that do not sample from pyramids just use its first level.
+    virtual void init(const cv::Rect &roi, const ImagePyramid &pyramid) { init(roi, pyramid.image()); }
+    virtual cv::Rect update(const ImagePyramid &pyramid) { return update(pyramid.image()); }
+
+    // Same from a borrowed frame. Trackers that do not take views directly get it converted to BGR.
+    virtual void init(const cv::Rect &roi, const FrameView &frame)
+    {
+        cv::Mat bgr, buffer;
+        frame.toBGR(bgr, buffer);
+        init(roi, bgr);
+    }
+    virtual cv::Rect update(const FrameView &frame)
+    {
+        cv::Mat bgr, buffer;
+        frame.toBGR(bgr, buffer);
+        return update(bgr);
+    }
+
+    // Frame region the patches of the next update() are read from, for callers that build or convert
+    // the frame for it. All of the frame by default.
+    virtual cv::Rect searchRegion() const { return cv::Rect(0, 0, INT_MAX, INT_MAX); }
+
 
 protected:
     cv::Rect_<float> _roi;
@@ -0,0 +1,214 @@
+/*
+Inner loops of the translation filter: the fused correlation of the feature spectra and the Lab
+histograms of the color features. The template spectra may be stored in half precision (see
+HalfFloat), the correlation converts them a row at a time.
+*/
+
+#pragma once
+
+#include "halffloat.hpp"
+#include <opencv2/core/core.hpp>
+
+namespace TrackerKernels
+{
+// dst = a * conj(b) over n interleaved (re, im) pairs, or dst += a * conj(b) with accumulate
+inline void mulConjPairs(const float *a, const float *b, float *dst, int n, bool accumulate)
+{
+    if (accumulate) {
+        for (int p = 0; p < 2 * n; p += 2) {
+            dst[p] += a[p] * b[p] + a[p + 1] * b[p + 1];
+            dst[p + 1] += a[p + 1] * b[p] - a[p] * b[p + 1];
+        }
+    }
+    else {
+        for (int p = 0; p < 2 * n; p += 2) {
+            dst[p] = a[p] * b[p] + a[p + 1] * b[p + 1];
+            dst[p + 1] = a[p + 1] * b[p] - a[p] * b[p + 1];
+        }
+    }
+}
+
+// Sum of the squared values of n floats
+inline double squaredSum(const float *a, int n)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        double v = a[i];
+        sum += v * v;
+    }
+    return sum;
+}
+
+// Values of float or half precision spectra, as floats
+inline float load(float value) { return value; }
+inline float load(short value) { return HalfFloat::toFloat(value); }
+
+template <typename T>
+inline float valueAt(const cv::Mat &a, int i, int j) { return load(a.at<T>(i, j)); }
+
+// Row of n values, converted into row unless they are floats already
+inline const float *loadRow(const float *p, int, float *) { return p; }
+inline const float *loadRow(const short *p, int n, float *row)
+{
+    HalfFloat::toFloat(p, row, n);
+    return row;
+}
+
+// Squares of the values of the purely real self-mirrored bins of a CCS spectrum, which
+// FFTTools::ccsEnergy counts once instead of twice
+template <typename T>
+double ccsCorners(const cv::Mat &a, int row, int rows)
+{
+    int cols = a.cols;
+    double c = valueAt<T>(a, row, 0), sum = c * c;
+    if (rows % 2 == 0) {
+        c = valueAt<T>(a, row + rows - 1, 0);
+        sum += c * c;
+    }
+    if (cols % 2 == 0) {
+        c = valueAt<T>(a, row, cols - 1);
+        sum += c * c;
+        if (rows % 2 == 0) {
+            c = valueAt<T>(a, row + rows - 1, cols - 1);
+            sum += c * c;
+        }
+    }
+    return sum;
+}
+
+// correlateSpectra for x2f of float (T2 float) or half precision values (T2 short), the latter
+// converted into row, a buffer of one row of floats
+template <typename T2>
+void correlateModel(const cv::Mat &x1f, const cv::Mat &x2f, int n, int rows, cv::Mat &cf, float *row, double &xx, double &yy)
+{
+    int cols = x1f.cols;
+    int pairs = (cols - 1) / 2;
+    cf.create(rows, cols, CV_32F);
+
+    double sum1 = 0, sum2 = 0;
+
+    // Interleaved pairs of every row
+    for (int i = 0; i < rows; i++) {
+        float *dst = cf.ptr<float>(i);
+        for (int c = 0; c < n; c++) {
+            const float *a = x1f.ptr<float>(c * rows + i);
+            const float *b = loadRow(x2f.ptr<T2>(c * rows + i), cols, row);
+            mulConjPairs(a + 1, b + 1, dst + 1, pairs, c > 0);
+            sum1 += squaredSum(a, cols);
+            sum2 += squaredSum(b, cols);
+        }
+    }
+
+    // Columns holding the spectra of the real DFT columns
+    for (int j = 0; j < cols; j += (cols % 2 == 0 && cols > 1) ? cols - 1 : cols) {
+        for (int c = 0; c < n; c++) {
+            int first = c * rows;
+            bool accumulate = c > 0;
+            float a0 = x1f.at<float>(first, j), b0 = valueAt<T2>(x2f, first, j);
+            cf.at<float>(0, j) = (accumulate ? cf.at<float>(0, j) : 0.f) + a0 * b0;
+            int i = 1;
+            for (; i + 1 < rows; i += 2) {
+                float a[2] = {x1f.at<float>(first + i, j), x1f.at<float>(first + i + 1, j)};
+                float b[2] = {valueAt<T2>(x2f, first + i, j), valueAt<T2>(x2f, first + i + 1, j)};
+                float d[2] = {cf.at<float>(i, j), cf.at<float>(i + 1, j)};
+                mulConjPairs(a, b, d, 1, accumulate);
+                cf.at<float>(i, j) = d[0];
+                cf.at<float>(i + 1, j) = d[1];
+            }
+            if (i < rows) {
+                float a1 = x1f.at<float>(first + i, j), b1 = valueAt<T2>(x2f, first + i, j);
+                cf.at<float>(i, j) = (accumulate ? cf.at<float>(i, j) : 0.f) + a1 * b1;
+            }
+        }
+    }
+
+    // Every packed value stands for a bin and its conjugate mirror, except the corners
+    xx = 2 * sum1;
+    yy = 2 * sum2;
+    for (int c = 0; c < n; c++) {
+        xx -= ccsCorners<float>(x1f, c * rows, rows);
+        yy -= ccsCorners<T2>(x2f, c * rows, rows);
+    }
+}
+
+// cf = sum over the channels of x1f * conj(x2f), for channels stacked CCS spectra of rows rows each
+// (see KCFTracker::fftFeatures), and the energies xx and yy of all channels of x1f and x2f, like
+// FFTTools::ccsEnergy. One pass over both inputs, instead of one product, sum and norm per channel.
+// x2f may be in half precision (CV_16S), row is the grow-only buffer for its conversion then.
+inline void correlateSpectra(const cv::Mat &x1f, const cv::Mat &x2f, int channels, int rows, cv::Mat &cf, cv::Mat &row, double &xx, double &yy)
+{
+    if (x2f.depth() == CV_16S) {
+        if (row.total() < (size_t) x2f.cols)
+            row.create(1, x2f.cols, CV_32F);
+        correlateModel<short>(x1f, x2f, channels, rows, cf, row.ptr<float>(), xx, yy);
+    }
+    else
+        correlateModel<float>(x1f, x2f, channels, rows, cf, NULL, xx, yy);
+}
+
+// Bits per BGR component of the Lab color-name lookup table
+#define LAB_LUT_BITS 5
+
+// Entry of the lookup table for a BGR pixel
+inline int labLutIndex(uchar b, uchar g, uchar r)
+{
+    const int shift = 8 - LAB_LUT_BITS;
+    return ((b >> shift) << (2 * LAB_LUT_BITS)) | ((g >> shift) << LAB_LUT_BITS) | (r >> shift);
+}
+
+// Largest cell, in pixels, that labHistograms() counts per cell
+const int LAB_COUNTED_CELL_PIXELS = 32 * 32;
+
+// Histograms of the nearest Lab centroids (lut, values below centroids) over the cells of the BGR
+// patch color, without the border cells. out holds one plane of cells floats per centroid and must
+// be zero.
+inline void labHistograms(const cv::Mat &color, const uchar *lut, int cs, int centroids, float *out, int cells)
+{
+    const double weight = 1.0 / (cs * cs);
+
+    // Cells of up to 5 x 5 pixels are faster added to their bins pixel by pixel
+    if (cs < 6 || cs * cs > LAB_COUNTED_CELL_PIXELS) {
+        int cntCell = 0;
+        for (int cY = cs; cY < color.rows - cs; cY += cs) {
+            for (int cX = cs; cX < color.cols - cs; cX += cs) {
+                float *histogram = out + cntCell;
+                for (int y = cY; y < cY + cs; ++y) {
+                    const uchar *bgr = color.ptr<uchar>(y) + cX * 3;
+                    for (int x = 0; x < cs; ++x, bgr += 3)
+                        histogram[lut[labLutIndex(bgr[0], bgr[1], bgr[2])] * cells] += weight;
+                }
+                cntCell++;
+            }
+        }
+        return;
+    }
+
+    // Larger cells count their pixels per centroid in integers first. A bin only ever gets weight
+    // added to zero, so sums[n], the float of n such additions, is exactly what adding its pixels
+    // one by one leaves in it.
+    float sums[LAB_COUNTED_CELL_PIXELS + 1];
+    sums[0] = 0;
+    for (int n = 1; n <= cs * cs; n++) {
+        sums[n] = sums[n - 1];
+        sums[n] += weight;
+    }
+
+    int counts[256];
+    int cntCell = 0;
+    for (int cY = cs; cY < color.rows - cs; cY += cs) {
+        for (int cX = cs; cX < color.cols - cs; cX += cs) {
+            for (int k = 0; k < centroids; k++)
+                counts[k] = 0;
+            for (int y = cY; y < cY + cs; ++y) {
+                const uchar *bgr = color.ptr<uchar>(y) + cX * 3;
+                for (int x = 0; x < cs; ++x, bgr += 3)
+                    counts[lut[labLutIndex(bgr[0], bgr[1], bgr[2])]]++;
+            }
+            for (int k = 0; k < centroids; k++)
+                if (counts[k] > 0)
+                    out[k * cells + cntCell] = sums[counts[k]];
+            cntCell++;
+        }
+    }
+}
+}
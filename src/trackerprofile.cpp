@@ -0,0 +1,41 @@
+#include "trackerprofile.hpp"
+#include "json/json.h"
+
+const char *TrackerProfile::name(Stage stage)
+{
+    static const char *names[NUM_STAGES] = {
+        "getFeatures", "gaussianCorrelation", "detect", "get_scale_sample", "detect_scale", "train_scale", "train"
+    };
+    return names[stage];
+}
+
+void TrackerProfile::reset()
+{
+    for (int i = 0; i < NUM_STAGES; i++) {
+        _stats[i].calls = 0;
+        _stats[i].total_ms = 0;
+        _stats[i].max_ms = 0;
+    }
+}
+
+void TrackerProfile::toJson(Json::Value &root) const
+{
+    root = Json::Value(Json::objectValue);
+    root["enabled"] = enabled();
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const Stats &s = _stats[i];
+        Json::Value &stage = root[name((Stage) i)];
+        stage["calls"] = (Json::Int64) s.calls;
+        stage["total_ms"] = s.total_ms;
+        stage["mean_ms"] = s.calls > 0 ? s.total_ms / s.calls : 0.0;
+        stage["max_ms"] = s.max_ms;
+    }
+}
+
+std::string TrackerProfile::toJsonString() const
+{
+    Json::Value root;
+    toJson(root);
+    Json::StreamWriterBuilder builder;
+    return Json::writeString(builder, root);
+}
@@ -0,0 +1,103 @@
+/*
+Time spent in the stages of KCFTracker::update(), per tracker.
+
+The timers are compiled in only with KCF_PROFILE defined (cmake -DKCF_PROFILE=ON). Without it
+KCF_PROFILE_SCOPE expands to nothing and the counters stay zero, so the hot path costs nothing.
+The stages nest: gaussianCorrelation is also part of detect and train, get_scale_sample of
+detect_scale and train_scale, and getFeatures is timed on its own.
+*/
+
+#pragma once
+
+#include <string>
+
+#ifdef KCF_PROFILE
+#include <chrono>
+#endif
+
+namespace Json
+{
+class Value;
+}
+
+class TrackerProfile
+{
+public:
+    enum Stage
+    {
+        GET_FEATURES,
+        GAUSSIAN_CORRELATION,
+        DETECT,
+        GET_SCALE_SAMPLE,
+        DETECT_SCALE,
+        TRAIN_SCALE,
+        TRAIN,
+        NUM_STAGES
+    };
+
+    struct Stats
+    {
+        long long calls;
+        double total_ms;
+        double max_ms;
+    };
+
+    TrackerProfile() { reset(); }
+
+    // Whether the timers are compiled in
+    static bool enabled()
+    {
+#ifdef KCF_PROFILE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static const char *name(Stage stage);
+
+    const Stats &stats(Stage stage) const { return _stats[stage]; }
+
+    void add(Stage stage, double ms)
+    {
+        Stats &s = _stats[stage];
+        s.calls++;
+        s.total_ms += ms;
+        if (ms > s.max_ms)
+            s.max_ms = ms;
+    }
+
+    void reset();
+
+    // {"enabled": ..., "<stage>": {"calls", "total_ms", "mean_ms", "max_ms"}, ...}
+    void toJson(Json::Value &root) const;
+    std::string toJsonString() const;
+
+private:
+    Stats _stats[NUM_STAGES];
+};
+
+#ifdef KCF_PROFILE
+// Adds the time until the end of the scope to a stage
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer(TrackerProfile &profile, TrackerProfile::Stage stage)
+        : _profile(profile), _stage(stage), _start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedStageTimer()
+    {
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - _start;
+        _profile.add(_stage, ms.count());
+    }
+
+private:
+    TrackerProfile &_profile;
+    TrackerProfile::Stage _stage;
+    std::chrono::steady_clock::time_point _start;
+};
+
+#define KCF_PROFILE_SCOPE(profile, stage) ScopedStageTimer kcf_stage_timer((profile), TrackerProfile::stage)
+#else
+#define KCF_PROFILE_SCOPE(profile, stage) ((void) 0)
+#endif
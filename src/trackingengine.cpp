@@ -0,0 +1,240 @@
+#include "trackingengine.hpp"
+#include "kcftracker.hpp"
+#include <algorithm>
+
+TrackingEngine::TrackingEngine(int threads, const Factory &factory)
+    : _factory(factory), _busy(0), _pool(threads)
+{
+    pyramid_levels = 8;
+}
+
+TrackingEngine::~TrackingEngine()
+{
+    {
+        std::unique_lock<std::mutex> lock(_streams_mutex);
+        _idle.wait(lock, [this] { return _busy == 0; });
+    }
+    for (size_t i = 0; i < _streams.size(); i++) {
+        std::map<int, Target> &targets = _streams[i]->targets;
+        for (std::map<int, Target>::iterator it = targets.begin(); it != targets.end(); ++it)
+            delete it->second.tracker;
+    }
+}
+
+KCFTracker *TrackingEngine::createTracker()
+{
+    KCFTracker *tracker = _factory ? _factory() : new KCFTracker();
+
+    // The scale stripes are tasks of the shared pool, where idle workers can steal them
+    tracker->scale_executor = &_pool;
+    if (tracker->scale_threads == 0)
+        tracker->scale_threads = _pool.threads();
+    return tracker;
+}
+
+int TrackingEngine::addStream(double budget_ms)
+{
+    Stream *s = new Stream();
+    s->busy = false;
+    s->stats.tracked = 0;
+    s->stats.dropped = 0;
+    s->stats.over_budget = 0;
+    s->stats.last_ms = 0;
+    s->stats.max_ms = 0;
+    s->budget_ms = budget_ms;
+    s->remaining = 0;
+
+    std::lock_guard<std::mutex> lock(_streams_mutex);
+    _streams.push_back(std::unique_ptr<Stream>(s));
+    return (int) _streams.size() - 1;
+}
+
+TrackingEngine::Stream &TrackingEngine::stream(int id) const
+{
+    std::lock_guard<std::mutex> lock(_streams_mutex);
+    return *_streams[id];
+}
+
+void TrackingEngine::addTarget(int id, int target, const cv::Rect &roi)
+{
+    Stream &s = stream(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.adds[target] = roi;
+    s.removes.erase(target);
+}
+
+void TrackingEngine::removeTarget(int id, int target)
+{
+    Stream &s = stream(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.adds.erase(target);
+    s.removes.insert(target);
+}
+
+void TrackingEngine::submit(int id, const cv::Mat &image, int64 frame_id)
+{
+    Stream &s = stream(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    Frame frame;
+    frame.image = image;
+    frame.id = frame_id;
+    frame.submitted = Clock::now();
+    s.queue.push_back(frame);
+
+    if (!s.busy) {
+        s.busy = true;
+        {
+            std::lock_guard<std::mutex> streams_lock(_streams_mutex);
+            _busy++;
+        }
+        scheduleNext(id);
+    }
+}
+
+void TrackingEngine::scheduleNext(int id)
+{
+    Stream &s = stream(id);
+
+    // Frames waiting longer than the budget are late already, unless there is nothing newer
+    if (s.budget_ms > 0) {
+        while (s.queue.size() > 1 &&
+               std::chrono::duration<double, std::milli>(Clock::now() - s.queue.front().submitted).count() > s.budget_ms) {
+            s.queue.pop_front();
+            s.stats.dropped++;
+        }
+    }
+
+    s.current = s.queue.front();
+    s.queue.pop_front();
+    _pool.submit([this, id] { trackFrame(id); });
+}
+
+void TrackingEngine::trackFrame(int id)
+{
+    Stream &s = stream(id);
+
+    // Apply the target changes made since the last frame and build the pyramid. If either fails,
+    // the frame finishes without tracking its targets.
+    bool ready = true;
+    try {
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for (std::set<int>::iterator it = s.removes.begin(); it != s.removes.end(); ++it) {
+                std::map<int, Target>::iterator target = s.targets.find(*it);
+                if (target != s.targets.end()) {
+                    delete target->second.tracker;
+                    s.targets.erase(target);
+                }
+            }
+            s.removes.clear();
+
+            for (std::map<int, cv::Rect>::iterator it = s.adds.begin(); it != s.adds.end(); ++it) {
+                // Created first, so that a factory that throws leaves the target as it was
+                KCFTracker *tracker = createTracker();
+                Target &target = s.targets[it->first];
+                delete target.tracker;
+                target.tracker = tracker;
+                target.initialized = false;
+                target.roi = it->second;
+            }
+            s.adds.clear();
+        }
+        s.pyramid.build(s.current.image, pyramid_levels);
+    }
+    catch (...) {
+        fail();
+        ready = false;
+    }
+
+    // One more for this task, so that the frame cannot finish before all targets are scheduled
+    s.remaining = (ready ? (int) s.targets.size() : 0) + 1;
+    for (std::map<int, Target>::iterator it = s.targets.begin(); ready && it != s.targets.end(); ++it) {
+        Target *target = &it->second;
+        _pool.submit([this, id, target] { trackTarget(id, target); });
+    }
+
+    if (--s.remaining == 0)
+        finishFrame(id);
+}
+
+void TrackingEngine::trackTarget(int id, Target *target)
+{
+    Stream &s = stream(id);
+    try {
+        if (target->initialized) {
+            target->roi = target->tracker->update(s.pyramid);
+        }
+        else {
+            target->tracker->init(target->roi, s.pyramid);
+            target->initialized = true;
+        }
+    }
+    catch (...) {
+        fail();
+    }
+
+    if (--s.remaining == 0)
+        finishFrame(id);
+}
+
+void TrackingEngine::finishFrame(int id)
+{
+    Stream &s = stream(id);
+
+    s.rois.clear();
+    for (std::map<int, Target>::iterator it = s.targets.begin(); it != s.targets.end(); ++it)
+        s.rois[it->first] = it->second.roi;
+
+    if (_callback) {
+        try {
+            _callback(id, s.current.id, s.rois);
+        }
+        catch (...) {
+            fail();
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - s.current.submitted).count();
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.stats.tracked++;
+    s.stats.last_ms = ms;
+    s.stats.max_ms = std::max(s.stats.max_ms, ms);
+    if (s.budget_ms > 0 && ms > s.budget_ms)
+        s.stats.over_budget++;
+
+    if (!s.queue.empty()) {
+        scheduleNext(id);
+        return;
+    }
+
+    s.busy = false;
+    std::lock_guard<std::mutex> streams_lock(_streams_mutex);
+    if (--_busy == 0)
+        _idle.notify_all();
+}
+
+void TrackingEngine::fail()
+{
+    std::lock_guard<std::mutex> lock(_streams_mutex);
+    if (!_error)
+        _error = std::current_exception();
+}
+
+void TrackingEngine::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(_streams_mutex);
+    _idle.wait(lock, [this] { return _busy == 0; });
+
+    std::exception_ptr error = _error;
+    _error = std::exception_ptr();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+TrackingEngine::StreamStats TrackingEngine::stats(int id) const
+{
+    Stream &s = stream(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.stats;
+}
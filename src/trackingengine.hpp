@@ -0,0 +1,139 @@
+/*
+Tracking engine for many video streams, each with its own set of targets.
+
+All streams share one WorkStealingPool. A frame becomes one task that builds the frame
+pyramid. That task then spawns a task per target, which initializes a new target or updates
+an existing one. Inside an update the scale sampling, the largest stage, is split once more
+into stripes on the same pool. Idle workers steal the stripes of the busy targets, so the cores
+stay busy when the streams have very different numbers of targets.
+
+The frames of a stream are tracked in order, one at a time. Frames submitted while the stream
+is busy wait in its queue. With a latency budget, the waiting frames that are already over it
+are dropped in favour of the newest one. The results of every frame are passed to the callback,
+from a pool thread. A target whose tracker throws keeps its last position for the frame, and an
+exception of the factory or the callback leaves the rest of the frame as it was; the first such
+exception is rethrown by waitIdle().
+*/
+
+#pragma once
+
+#include "workstealingpool.hpp"
+#include "imagepyramid.hpp"
+#include <opencv2/core/core.hpp>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+
+class KCFTracker;
+
+class TrackingEngine
+{
+public:
+    // Results of frame frame_id of stream: the positions of its targets by id
+    typedef std::function<void(int stream, int64 frame_id, const std::map<int, cv::Rect> &rois)> Callback;
+
+    // Creates the tracker of a new target
+    typedef std::function<KCFTracker *()> Factory;
+
+    struct StreamStats
+    {
+        int64 tracked;       // frames tracked
+        int64 dropped;       // frames dropped for the latency budget
+        int64 over_budget;   // tracked frames that took longer than the budget from submit() to the callback
+        double last_ms;      // latency of the last tracked frame
+        double max_ms;
+    };
+
+    // Engine on a pool of threads workers, 0 for one per core. The default factory creates
+    // KCFTrackers with the default parameters.
+    explicit TrackingEngine(int threads = 0, const Factory &factory = Factory());
+
+    // Waits for all submitted frames
+    ~TrackingEngine();
+
+    void setCallback(const Callback &callback) { _callback = callback; }
+
+    // New stream with a latency budget in milliseconds, 0 for none. Returns its id.
+    int addStream(double budget_ms = 0);
+
+    // Start tracking a target at roi in the next frame of the stream, replacing any target with that id
+    void addTarget(int stream, int id, const cv::Rect &roi);
+
+    // Stop tracking a target from the next frame of the stream on
+    void removeTarget(int stream, int id);
+
+    // Queue a frame of the stream, the image must not be written to before its callback
+    void submit(int stream, const cv::Mat &frame, int64 frame_id);
+
+    // Wait until all submitted frames are tracked or dropped, then rethrow the first exception of a
+    // tracker, the factory or the callback since the last call, if any
+    void waitIdle();
+
+    StreamStats stats(int stream) const;
+
+    int pyramid_levels; // levels of the frame pyramids, see ImagePyramid
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Frame
+    {
+        cv::Mat image;
+        int64 id;
+        Clock::time_point submitted;
+    };
+
+    struct Target
+    {
+        Target() : tracker(NULL), initialized(false) {}
+
+        KCFTracker *tracker;
+        bool initialized;
+        cv::Rect roi; // initial roi until initialized, then the last result
+    };
+
+    struct Stream
+    {
+        mutable std::mutex mutex;   // guards everything up to stats
+        std::deque<Frame> queue;
+        bool busy;                  // a frame of the stream is being tracked
+        std::map<int, cv::Rect> adds;
+        std::set<int> removes;
+        StreamStats stats;
+
+        // Only touched by the tasks of the frame being tracked
+        double budget_ms;
+        Frame current;
+        ImagePyramid pyramid;
+        std::map<int, Target> targets;
+        std::map<int, cv::Rect> rois;
+        std::atomic<int> remaining; // target tasks of the current frame still running
+    };
+
+    Stream &stream(int id) const;
+
+    // Pop the next frame of a stream, dropping the ones over budget, and schedule it. Called with the stream locked.
+    void scheduleNext(int stream);
+
+    void trackFrame(int stream);
+    void trackTarget(int stream, Target *target);
+    void finishFrame(int stream);
+
+    // Keep the exception being handled for waitIdle(), unless there is an earlier one
+    void fail();
+
+    KCFTracker *createTracker();
+
+    Factory _factory;
+    Callback _callback;
+
+    mutable std::mutex _streams_mutex; // guards _streams and _busy
+    std::vector<std::unique_ptr<Stream> > _streams;
+    int _busy;                         // busy streams
+    std::condition_variable _idle;
+    std::exception_ptr _error;         // guarded by _streams_mutex, see waitIdle()
+
+    // Last, so that the workers are joined before the streams they may still be leaving go away
+    WorkStealingPool _pool;
+};
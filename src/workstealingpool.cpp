@@ -0,0 +1,175 @@
+#include "workstealingpool.hpp"
+
+// Index of the pool worker running on this thread, -1 elsewhere
+static thread_local int t_worker = -1;
+static thread_local const WorkStealingPool *t_pool = NULL;
+
+WorkStealingPool::WorkStealingPool(int threads)
+    : _queued(0), _next(0), _stop(false)
+{
+    if (threads <= 0)
+        threads = std::max(1, (int) std::thread::hardware_concurrency());
+
+    for (int i = 0; i < threads; i++)
+        _queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    for (int i = 0; i < threads; i++)
+        _threads.push_back(std::thread(&WorkStealingPool::work, this, i));
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleep);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++)
+        _threads[i].join();
+}
+
+void WorkStealingPool::submit(const std::function<void()> &task)
+{
+    int self = t_pool == this ? t_worker : -1;
+    int q = self >= 0 ? self : (int) (_next++ % _queues.size());
+    {
+        std::lock_guard<std::mutex> lock(_queues[q]->mutex);
+        _queues[q]->tasks.push_back(task);
+    }
+    _queued++;
+
+    // Taking the lock orders the count before a worker that is about to sleep checks it
+    { std::lock_guard<std::mutex> lock(_sleep); }
+    _wake.notify_one();
+}
+
+bool WorkStealingPool::tryRun(int self)
+{
+    std::function<void()> task;
+    int n = (int) _queues.size();
+
+    // Own queue newest first, the others oldest first starting after self
+    for (int k = 0; k < n && !task; k++) {
+        int q = self >= 0 ? (self + k) % n : k;
+        Queue &queue = *_queues[q];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+        if (q == self) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task)
+        return false;
+
+    _queued--;
+    try {
+        task();
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(_error_mutex);
+        if (!_error)
+            _error = std::current_exception();
+    }
+    return true;
+}
+
+std::exception_ptr WorkStealingPool::takeError()
+{
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    std::exception_ptr error = _error;
+    _error = std::exception_ptr();
+    return error;
+}
+
+void WorkStealingPool::work(int self)
+{
+    t_worker = self;
+    t_pool = this;
+    for (;;) {
+        if (tryRun(self))
+            continue;
+
+        std::unique_lock<std::mutex> lock(_sleep);
+        _wake.wait(lock, [this] { return _stop || _queued > 0; });
+        if (_stop && _queued == 0)
+            return;
+    }
+}
+
+namespace
+{
+// The stripes of one parallelFor(), claimed one at a time by its tasks and its caller
+struct Loop
+{
+    Loop(const cv::Range &range, const cv::ParallelLoopBody &body, int n)
+        : range(range), body(body), n(n), next(0), done(0) {}
+
+    // Claim and run the next stripe, false once all are claimed. An exception counts the stripe as
+    // done and is kept for the caller, the first one if several stripes throw. The last stripe to
+    // finish wakes the caller.
+    bool runStripe()
+    {
+        int i = next++;
+        if (i >= n)
+            return false;
+
+        // Stripe i covers the same part of range as in cv::parallel_for_
+        cv::Range stripe(range.start + (int) ((int64) range.size() * i / n), range.start + (int) ((int64) range.size() * (i + 1) / n));
+        try {
+            body(stripe);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+
+        // Notified under the lock, so that the caller cannot miss it between its check and its wait
+        if (++done == n) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.notify_all();
+        }
+        return true;
+    }
+
+    // Sleep until all stripes are done
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return done == n; });
+    }
+
+    const cv::Range range;
+    const cv::ParallelLoopBody &body;
+    const int n;
+    std::atomic<int> next;
+    std::atomic<int> done;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+};
+}
+
+void WorkStealingPool::parallelFor(const cv::Range &range, const cv::ParallelLoopBody &body, int nstripes)
+{
+    int n = std::max(1, std::min(nstripes, range.size()));
+
+    // The tasks may run after the call returns and then find no stripe left, so they share the state
+    std::shared_ptr<Loop> loop = std::make_shared<Loop>(range, body, n);
+    for (int i = 1; i < n; i++)
+        submit([loop] { loop->runStripe(); });
+
+    // Run the stripes nobody has started, then wait for the others. Unrelated tasks are not run here:
+    // one of them could block, or recurse, and hold up this loop behind it.
+    while (loop->runStripe())
+        ;
+    loop->wait();
+
+    if (loop->error)
+        std::rethrow_exception(loop->error);
+}
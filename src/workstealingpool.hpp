@@ -0,0 +1,75 @@
+/*
+Thread pool with one task queue per worker and work stealing.
+
+A worker runs the tasks of its own queue newest first and, once it is empty, steals the oldest
+task of another worker. Tasks submitted from a worker go to its own queue, others are spread
+round robin. parallelFor() splits a loop into stripes and queues tasks that run them. Its caller runs
+the stripes no worker has started yet, and no other tasks, then sleeps until the rest are done, so it
+can be called from inside a task. An exception of a stripe is rethrown by parallelFor() once all
+stripes are done. An exception of a submitted task does not leave its worker, it is kept for
+takeError().
+*/
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs the stripes of a cv::ParallelLoopBody, the extension point of KCFTracker::scale_executor
+class ParallelExecutor
+{
+public:
+    virtual ~ParallelExecutor() {}
+
+    // Same as cv::parallel_for_(range, body, nstripes), returns when all of range is done
+    virtual void parallelFor(const cv::Range &range, const cv::ParallelLoopBody &body, int nstripes) = 0;
+};
+
+class WorkStealingPool : public ParallelExecutor
+{
+public:
+    // Pool of threads workers, 0 for one per core
+    explicit WorkStealingPool(int threads = 0);
+
+    // Runs the queued tasks, then joins the workers
+    virtual ~WorkStealingPool();
+
+    int threads() const { return (int) _threads.size(); }
+
+    void submit(const std::function<void()> &task);
+
+    // The first exception a submitted task threw since the last call, null if none did
+    std::exception_ptr takeError();
+
+    virtual void parallelFor(const cv::Range &range, const cv::ParallelLoopBody &body, int nstripes);
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    // Run one task, from the queue of worker self (-1 outside the pool) or stolen. False if there was none.
+    bool tryRun(int self);
+
+    void work(int self);
+
+    std::vector<std::unique_ptr<Queue> > _queues;
+    std::vector<std::thread> _threads;
+    std::atomic<int> _queued;    // tasks in all queues
+    std::atomic<unsigned> _next; // round robin queue of outside submissions
+    std::mutex _sleep;
+    std::condition_variable _wake;
+    bool _stop;
+    std::mutex _error_mutex;
+    std::exception_ptr _error;   // first exception of a task, see takeError()
+};
@@ -0,0 +1,36 @@
+/*
+Synthetic sequence for the tracker tests: a textured square moving over a textured background,
+the same for every run.
+*/
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cmath>
+
+// Frame i of the sequence, 320x240 BGR, and the rectangle of the square in it. The square moves
+// by (3, 2) pixels a frame, starting from 48x48 at (60, 50), and grows by 1% a frame with grow.
+// It stays inside the frame for the first 30 frames.
+inline cv::Mat syntheticFrame(int i, cv::Rect *target = NULL, bool grow = false)
+{
+    cv::Mat frame(240, 320, CV_8UC3);
+    cv::RNG(1).fill(frame, cv::RNG::UNIFORM, 0, 256);
+    cv::GaussianBlur(frame, frame, cv::Size(7, 7), 0);
+
+    // Checkerboard under noise, with strong edges at every size
+    cv::Mat texture(64, 64, CV_8UC3);
+    cv::RNG(2).fill(texture, cv::RNG::UNIFORM, 0, 96);
+    for (int y = 0; y < texture.rows; y++)
+        for (int x = 0; x < texture.cols; x++)
+            if (((x / 8) + (y / 8)) % 2)
+                texture.at<cv::Vec3b>(y, x) += cv::Vec3b(160, 120, 80);
+
+    int size = grow ? cvRound(48 * std::pow(1.01, i)) : 48;
+    cv::Rect rect(60 + 3 * i, 50 + 2 * i, size, size);
+    cv::Mat square = frame(rect);
+    cv::resize(texture, square, rect.size());
+    if (target)
+        *target = rect;
+    return frame;
+}
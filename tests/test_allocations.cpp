@@ -0,0 +1,69 @@
+/*
+Zero-allocation steady state of update(), in builds with KCF_CHECK_ALLOCATIONS: from the second
+update() on, the tracker asserts that it allocated nothing but the grow-only subwindow and pyramid
+buffers, counted from before it builds the pyramid of the frame. An allocation aborts this test.
+The growing target moves and changes the search region, and so the pyramid levels, every frame.
+The scale samples are computed serially, as the allocations are counted per thread.
+*/
+
+#include "kcftracker.hpp"
+#include "synthetic.hpp"
+#include "testing.hpp"
+
+struct Configuration
+{
+    const char *name;
+    bool hog, lab, fast_scale, half_storage, adaptive, reuse_sample;
+};
+
+int main()
+{
+#ifdef NDEBUG
+    fprintf(stderr, "test_allocations checks the asserts of update(), build it without NDEBUG\n");
+    return 1;
+#endif
+    const Configuration configurations[] = {
+        {"default", true, false, false, false, false, false},
+        {"gray", false, false, false, false, false, false},
+        {"lab", true, true, false, false, false, false},
+        {"fast scale", true, false, true, false, false, false},
+        {"half storage", true, false, false, true, false, false},
+        {"fast scale, half storage", true, false, true, true, false, false},
+        {"adaptive", true, false, false, false, true, false},
+        {"reuse sample", true, false, false, false, false, true},
+    };
+
+    for (size_t c = 0; c < sizeof(configurations) / sizeof(configurations[0]); c++) {
+        const Configuration &config = configurations[c];
+        for (int run = 0; run < 3; run++) {
+            // The growing target is tracked from frames and from views of them
+            bool grow = run > 0, view = run > 1;
+            printf("%s%s%s\n", config.name, grow ? ", growing target" : "", view ? ", frame view" : "");
+            KCFTracker tracker(config.hog, true, true, config.lab);
+            tracker.scale_threads = 1;
+            tracker.fast_scale = config.fast_scale;
+            if (config.fast_scale)
+                tracker.n_scales = 17;
+            tracker.half_storage = config.half_storage;
+            tracker.adaptive = config.adaptive;
+            tracker.scale_reuse_sample = config.reuse_sample;
+
+            cv::Rect target;
+            cv::Mat frame = syntheticFrame(0, &target, grow);
+            tracker.init(target, frame);
+            cv::Rect roi = target;
+            for (int i = 1; i < (grow ? 30 : 16); i++) {
+                frame = syntheticFrame(i, &target, grow);
+                if (view)
+                    roi = tracker.update(FrameView::bgr(frame.data, frame.cols, frame.rows, frame.step));
+                else
+                    roi = tracker.update(frame);
+                CHECK(roi.width > 0 && roi.height > 0);
+            }
+            // The search region followed the target's size
+            if (grow)
+                CHECK(roi.width > 48 && roi.height > 48);
+        }
+    }
+    return testResult();
+}
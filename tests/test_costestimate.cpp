@@ -0,0 +1,39 @@
+/*
+estimateCost(): the estimate counts the pyramid levels update(image) builds over the search region,
+nothing without a pyramid, and grows with the target.
+*/
+
+#include <cmath>
+#include "kcftracker.hpp"
+#include "synthetic.hpp"
+#include "testing.hpp"
+
+int main()
+{
+    KCFTracker tracker(true, true, true, false);
+    CHECK(tracker.estimateCost().total == 0);
+
+    cv::Rect target;
+    cv::Mat frame = syntheticFrame(0, &target);
+    tracker.init(target, frame);
+    KCFTracker::CostEstimate cost = tracker.estimateCost();
+    CHECK(cost.region_pixels > 0);
+
+    // 320x240 frames have two levels above the frame, of a quarter and a sixteenth of the region
+    double levels = 4 * (cost.region_pixels / 4 + cost.region_pixels / 16);
+    CHECK(std::abs(cost.pyramid_pixels - levels) < 1e-6 * levels);
+    CHECK(cost.total > cost.pyramid_pixels + cost.patch_pixels + cost.scale_pixels);
+
+    tracker.pyramid_levels = 1;
+    KCFTracker::CostEstimate flat = tracker.estimateCost();
+    CHECK(flat.pyramid_pixels == 0);
+    CHECK(flat.total == cost.total - cost.pyramid_pixels);
+
+    // A larger target reads more of the frame
+    KCFTracker large(true, true, true, false);
+    large.init(cv::Rect(80, 60, 96, 96), frame);
+    CHECK(large.estimateCost().region_pixels > cost.region_pixels);
+    CHECK(large.estimateCost().pyramid_pixels > cost.pyramid_pixels);
+
+    return testResult();
+}
@@ -0,0 +1,39 @@
+/*
+DFTPlan against cv::dft: the forward transform gives the CCS spectrum of cv::dft and the inverse
+one gives back the input, on even and odd sizes. With FFT_BACKEND=FFTW this checks the packing
+of the FFTW half spectra, with OpenCV the plans are cv::dft itself.
+*/
+
+#include <opencv2/core/core.hpp>
+#include "ffttools.hpp"
+#include "testing.hpp"
+
+int main()
+{
+    const int sizes[][2] = {{2, 2}, {2, 7}, {7, 2}, {5, 7}, {6, 9}, {9, 6}, {24, 24}, {25, 31}, {16, 33}, {33, 16}};
+    cv::RNG rng(5);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int rows = sizes[s][0], cols = sizes[s][1];
+        cv::Mat x(rows, cols, CV_32F);
+        rng.fill(x, cv::RNG::UNIFORM, -1, 1);
+
+        FFTTools::DFTPlan plan;
+        plan.create(rows, cols);
+
+        cv::Mat spectrum, expected;
+        plan.forward(x, spectrum);
+        cv::dft(x, expected);
+        CHECK(spectrum.size() == expected.size() && spectrum.type() == CV_32FC1);
+        CHECK(cv::norm(spectrum, expected, cv::NORM_INF) <= 1e-5 * (1 + cv::norm(expected, cv::NORM_INF)));
+
+        // The inverse of the cv::dft spectrum, so that the unpacking is checked on its own
+        cv::Mat back, expected_back;
+        plan.inverse(expected, back);
+        cv::dft(expected, expected_back, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+        CHECK(back.size() == x.size() && back.type() == CV_32FC1);
+        CHECK(cv::norm(back, expected_back, cv::NORM_INF) <= 1e-5);
+        CHECK(cv::norm(back, x, cv::NORM_INF) <= 1e-5);
+    }
+    return testResult();
+}
@@ -0,0 +1,86 @@
+/*
+normalizeAndPCAFeatureMapsWs, the one-pass normalization and PCA the tracker runs, against
+normalizeAndTruncate followed by PCAFeatureMaps. The results must be the same to the bit, in the
+cell-major and planar layouts and in place, on the feature maps of images and on random maps
+with empty cells.
+*/
+
+#include <opencv2/core/core.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "fhog.hpp"
+#include "synthetic.hpp"
+#include "testing.hpp"
+
+// Checks the fused pass on the map of ws, which it replaces by the reduced map
+static void checkFused(CvLSVMFeatureWorkspace *ws)
+{
+    const CvLSVMFeatureMapCaskade &map = ws->map;
+    CvLSVMFeatureMapCaskade *expected;
+    allocFeatureMapObject(&expected, map.sizeX, map.sizeY, map.numFeatures);
+    memcpy(expected->map, map.map, sizeof(float) * map.sizeX * map.sizeY * map.numFeatures);
+    normalizeAndTruncate(expected, 0.2f);
+    PCAFeatureMaps(expected);
+
+    int cells = expected->sizeX * expected->sizeY, p = expected->numFeatures;
+    CHECK(p == NUM_SECTOR * 3 + 4);
+    std::vector<float> cellMajor(cells * p), planar(cells * p);
+    normalizeAndPCAFeatureMapsWs(ws, 0.2f, &cellMajor[0], 0);
+    normalizeAndPCAFeatureMapsWs(ws, 0.2f, &planar[0], 1);
+    normalizeAndPCAFeatureMapsWs(ws, 0.2f, NULL, 0);
+    CHECK(map.sizeX == expected->sizeX && map.sizeY == expected->sizeY && map.numFeatures == p);
+
+    int mismatches = 0;
+    for (int c = 0; c < cells; c++) {
+        for (int f = 0; f < p; f++) {
+            const float *value = &expected->map[c * p + f];
+            mismatches += memcmp(value, &cellMajor[c * p + f], sizeof(float)) != 0;
+            mismatches += memcmp(value, &planar[f * cells + c], sizeof(float)) != 0;
+            mismatches += memcmp(value, &map.map[c * p + f], sizeof(float)) != 0;
+        }
+    }
+    CHECK(mismatches == 0);
+    freeFeatureMapObject(&expected);
+}
+
+int main()
+{
+    // Maps of a synthetic frame, of patches of the sizes of the translation and scale samples
+    cv::Mat gray;
+    cv::cvtColor(syntheticFrame(0), gray, cv::COLOR_BGR2GRAY);
+    const cv::Rect patches[] = {cv::Rect(0, 0, 104, 104), cv::Rect(40, 30, 96, 64), cv::Rect(50, 40, 32, 48), cv::Rect(10, 10, 20, 20)};
+    for (size_t i = 0; i < sizeof(patches) / sizeof(patches[0]); i++) {
+        for (int channels = 1; channels <= 3; channels += 2) {
+            cv::Mat patch = channels == 1 ? gray(patches[i]).clone() : syntheticFrame(0)(patches[i]).clone();
+            IplImage image = patch;
+            CvLSVMFeatureWorkspace *ws;
+            allocFeatureWorkspace(&ws);
+            getFeatureMapsWs(&image, 4, ws);
+            checkFused(ws);
+            freeFeatureWorkspace(&ws);
+        }
+    }
+
+    // Random maps of small and large values, a quarter of them zero
+    const int sizes[][2] = {{3, 3}, {4, 7}, {12, 12}, {26, 26}, {25, 19}};
+    cv::RNG rng(3);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (int seed = 0; seed < 10; seed++) {
+            CvLSVMFeatureWorkspace *ws;
+            allocFeatureWorkspace(&ws);
+            CvLSVMFeatureMapCaskade &map = ws->map;
+            map.sizeX = sizes[s][0];
+            map.sizeY = sizes[s][1];
+            map.numFeatures = NUM_SECTOR * 3;
+            int n = map.sizeX * map.sizeY * map.numFeatures;
+            map.map = (float *) malloc(sizeof(float) * n);
+            ws->mapCapacity = sizeof(float) * n;
+            for (int i = 0; i < n; i++)
+                map.map[i] = rng.uniform(0, 4) == 0 ? 0.f : rng.uniform(0.f, 1.f) * (rng.uniform(0, 2) ? 100.f : 0.01f);
+            checkFused(ws);
+            freeFeatureWorkspace(&ws);
+        }
+    }
+    return testResult();
+}
@@ -0,0 +1,147 @@
+/*
+HalfFloat conversions: every half against its value, the rounding of floats to the nearest even
+half, infinities, NaNs and subnormals, and the array and matrix functions, which may run on
+F16C or NEON, against the scalar ones.
+*/
+
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "halffloat.hpp"
+#include "testing.hpp"
+
+static uint16_t bits(short half) { return (uint16_t) half; }
+
+static float fromBits(uint32_t x)
+{
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+static bool isNaNHalf(uint16_t h) { return (h & 0x7c00) == 0x7c00 && (h & 0x3ff) != 0; }
+
+// Value of a finite half
+static double halfValue(uint16_t h)
+{
+    int exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+    double magnitude = exponent == 0 ? std::ldexp((double) mantissa, -24) : std::ldexp((double) (1024 + mantissa), exponent - 25);
+    return h & 0x8000 ? -magnitude : magnitude;
+}
+
+int main()
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    // Known conversions, with the ties rounded to even
+    const struct { float value; uint16_t half; } known[] = {
+        {0.f, 0x0000}, {-0.f, 0x8000}, {1.f, 0x3c00}, {-2.f, 0xc000}, {0.5f, 0x3800}, {0.1f, 0x2e66},
+        {65504.f, 0x7bff}, {65519.f, 0x7bff}, {65520.f, 0x7c00}, {1e10f, 0x7c00}, {-1e10f, 0xfc00},
+        {infinity, 0x7c00}, {-infinity, 0xfc00},
+        {std::ldexp(1.f, -14), 0x0400}, {std::ldexp(1.f, -24), 0x0001}, {std::ldexp(1.f, -25), 0x0000},
+        {std::ldexp(3.f, -25), 0x0002}, {std::ldexp(1.0001f, -25), 0x0001}, {std::ldexp(1.f, -30), 0x0000},
+        {1.f + std::ldexp(1.f, -11), 0x3c00}, {1.f + std::ldexp(3.f, -11), 0x3c02},
+        {1.f + std::ldexp(1.f, -11) + std::ldexp(1.f, -20), 0x3c01},
+    };
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++)
+        CHECK(bits(HalfFloat::fromFloat(known[i].value)) == known[i].half);
+    CHECK(isNaNHalf(bits(HalfFloat::fromFloat(std::numeric_limits<float>::quiet_NaN()))));
+    CHECK(isNaNHalf(bits(HalfFloat::fromFloat(fromBits(0xff800001u)))));
+
+    // Every half converts to its value and back to itself, NaNs stay NaNs
+    std::vector<short> halves(65536);
+    for (int h = 0; h < 65536; h++) {
+        halves[h] = (short) h;
+        float f = HalfFloat::toFloat((short) h);
+        if (isNaNHalf(h)) {
+            CHECK(f != f);
+            CHECK(isNaNHalf(bits(HalfFloat::fromFloat(f))));
+        }
+        else if ((h & 0x7fff) == 0x7c00) {
+            CHECK(f == (h & 0x8000 ? -infinity : infinity));
+            CHECK(bits(HalfFloat::fromFloat(f)) == h);
+        }
+        else {
+            CHECK(f == halfValue(h));
+            CHECK(bits(HalfFloat::fromFloat(f)) == h);
+        }
+    }
+
+    // Floats go to the nearest half, on a tie the even one. A stride over the bit patterns of the
+    // positive floats below the half overflow; the signs are symmetric.
+    int not_nearest = 0;
+    for (uint32_t x = 0; x < 0x477ff000u; x += 4099) {
+        double value = fromBits(x);
+        uint16_t h = bits(HalfFloat::fromFloat((float) value));
+        double error = std::fabs(halfValue(h) - value);
+        bool nearest = (h == 0 || error <= std::fabs(halfValue(h - 1) - value)) &&
+                       (h == 0x7bff || error <= std::fabs(halfValue(h + 1) - value));
+        bool tie = (h > 0 && error == std::fabs(halfValue(h - 1) - value)) ||
+                   (h < 0x7bff && error == std::fabs(halfValue(h + 1) - value));
+        not_nearest += !nearest || (tie && (h & 1));
+        CHECK(bits(HalfFloat::fromFloat(-(float) value)) == (h | 0x8000));
+    }
+    CHECK(not_nearest == 0);
+
+    // The array functions give the scalar results, also on the tails of odd lengths
+    std::vector<float> floats(halves.size());
+    HalfFloat::toFloat(&halves[0], &floats[0], (int) halves.size());
+    int differ = 0;
+    for (size_t i = 0; i < halves.size(); i++) {
+        float f = HalfFloat::toFloat(halves[i]);
+        differ += memcmp(&f, &floats[i], 4) != 0 && !(f != f && floats[i] != floats[i]);
+    }
+    CHECK(differ == 0);
+
+    std::vector<float> values(1001);
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = std::ldexp((float) i - 500.f, (int) (i % 21) - 24) * 1.37f;
+    std::vector<short> converted(values.size());
+    for (int n = 1; n <= 17; n += 4) {
+        HalfFloat::fromFloat(&values[0], &converted[0], (int) values.size() - n);
+        differ = 0;
+        for (size_t i = 0; i + n < values.size(); i++)
+            differ += converted[i] != HalfFloat::fromFloat(values[i]);
+        CHECK(differ == 0);
+    }
+
+    // dst = alpha * dst + beta * src in half precision, to the rounding of the result
+    std::vector<short> blended(values.size());
+    std::vector<float> src(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        blended[i] = HalfFloat::fromFloat(values[(i * 7) % values.size()]);
+        src[i] = values[i];
+    }
+    std::vector<short> before(blended);
+    HalfFloat::addWeighted(&blended[0], 0.975f, &src[0], 0.025f, (int) blended.size());
+    int far = 0;
+    for (size_t i = 0; i < blended.size(); i++) {
+        double expected = 0.975 * HalfFloat::toFloat(before[i]) + 0.025 * (double) src[i];
+        double error = std::fabs(HalfFloat::toFloat(blended[i]) - expected);
+        far += error > std::ldexp(std::fabs(expected), -10) + std::ldexp(1.0, -24);
+    }
+    CHECK(far == 0);
+
+    // Matrices of two channels, and a CV_16S destination reused only with the same size
+    cv::Mat m, half, back;
+    m.create(7, 13, CV_32FC2);
+    for (int y = 0; y < m.rows; y++)
+        for (int x = 0; x < 2 * m.cols; x++)
+            m.ptr<float>(y)[x] = values[(y * 2 * m.cols + x) % values.size()];
+    HalfFloat::fromFloat(m, half);
+    CHECK(half.size() == m.size() && half.depth() == CV_16S && half.channels() == 2);
+    HalfFloat::toFloat(half, back);
+    CHECK(back.size() == m.size() && back.depth() == CV_32F && back.channels() == 2);
+    differ = 0;
+    for (int y = 0; y < m.rows; y++) {
+        for (int x = 0; x < 2 * m.cols; x++) {
+            short h = HalfFloat::fromFloat(m.ptr<float>(y)[x]);
+            differ += half.ptr<short>(y)[x] != h || back.ptr<float>(y)[x] != HalfFloat::toFloat(h);
+        }
+    }
+    CHECK(differ == 0);
+
+    return testResult();
+}
@@ -0,0 +1,53 @@
+/*
+TrackerKernels::labHistograms: the per-cell counting of the larger cells gives the same bits as
+adding the pixels to their bins one by one, for every cell size.
+*/
+
+#include <string.h>
+#include <vector>
+#include "trackerkernels.hpp"
+#include "testing.hpp"
+
+using namespace TrackerKernels;
+
+// The histograms pixel by pixel, as labHistograms() computes them for small cells
+static void reference(const cv::Mat &color, const uchar *lut, int cs, float *out, int cells)
+{
+    const double weight = 1.0 / (cs * cs);
+    int cell = 0;
+    for (int cY = cs; cY < color.rows - cs; cY += cs) {
+        for (int cX = cs; cX < color.cols - cs; cX += cs) {
+            for (int y = cY; y < cY + cs; ++y) {
+                const uchar *bgr = color.ptr<uchar>(y) + cX * 3;
+                for (int x = 0; x < cs; ++x, bgr += 3)
+                    out[lut[labLutIndex(bgr[0], bgr[1], bgr[2])] * cells + cell] += weight;
+            }
+            cell++;
+        }
+    }
+}
+
+int main()
+{
+    const int centroids = 15;
+    cv::RNG rng(3);
+    std::vector<uchar> lut(1 << (3 * LAB_LUT_BITS));
+    for (size_t i = 0; i < lut.size(); i++)
+        lut[i] = (uchar) rng.uniform(0, centroids);
+
+    for (int cs = 1; cs <= 12; cs++) {
+        // Uniform patches fill a single bin per cell, noisy ones many
+        for (int noisy = 0; noisy < 2; noisy++) {
+            cv::Mat color(cs * 9, cs * 11, CV_8UC3, cv::Scalar(40, 90, 200));
+            if (noisy)
+                rng.fill(color, cv::RNG::UNIFORM, 0, 256);
+
+            int cells = (color.rows / cs - 2) * (color.cols / cs - 2);
+            std::vector<float> expected(centroids * cells, 0.f), histograms(centroids * cells, 0.f);
+            reference(color, &lut[0], cs, &expected[0], cells);
+            labHistograms(color, &lut[0], cs, centroids, &histograms[0], cells);
+            CHECK(memcmp(&expected[0], &histograms[0], expected.size() * sizeof(float)) == 0);
+        }
+    }
+    return testResult();
+}
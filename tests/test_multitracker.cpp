@@ -0,0 +1,64 @@
+/*
+MultiTracker on NV12 views with Lab features: the targets sample their translation patches from the
+colors converted once over the union of their search regions, and the pyramid only covers that
+union, which must track exactly like a KCFTracker per target converting its own windows. The
+targets are large enough for their patches to be shrunk, enlarged patches would differ at the edges.
+*/
+
+#include <string.h>
+#include "kcftracker.hpp"
+#include "multitracker.hpp"
+#include "synthetic.hpp"
+#include "testing.hpp"
+
+// NV12 planes of a BGR frame, in nv12: the Y rows followed by the interleaved UV rows
+static FrameView toNV12(const cv::Mat &bgr, cv::Mat &nv12)
+{
+    cv::Mat i420;
+    cv::cvtColor(bgr, i420, cv::COLOR_BGR2YUV_I420);
+    nv12.create(i420.size(), CV_8UC1);
+    int w = bgr.cols, h = bgr.rows;
+    memcpy(nv12.data, i420.data, (size_t) w * h);
+    const uchar *u = i420.data + w * h, *v = u + w * h / 4;
+    uchar *uv = nv12.data + w * h;
+    for (int i = 0; i < w * h / 4; i++) {
+        uv[2 * i] = u[i];
+        uv[2 * i + 1] = v[i];
+    }
+    return FrameView::nv12(nv12.data, w, nv12.data + w * h, w, w, h);
+}
+
+int main()
+{
+    cv::Rect square;
+    cv::Mat frame = syntheticFrame(0, &square, true), nv12;
+    std::map<int, cv::Rect> rois;
+    rois[0] = square;
+    rois[1] = cv::Rect(200, 140, 40, 56); // background texture
+
+    MultiTracker multi(true, true, true, true);
+    cv::Mat bgr;
+    toNV12(frame, nv12);
+    cv::cvtColor(nv12, bgr, cv::COLOR_YUV2BGR_NV12);
+    multi.add(rois, bgr);
+
+    KCFTracker *single[2];
+    for (int t = 0; t < 2; t++) {
+        single[t] = new KCFTracker(true, true, true, true);
+        single[t]->scale_threads = 1;
+        single[t]->init(rois[t], bgr);
+    }
+
+    for (int i = 1; i < 20; i++) {
+        FrameView view = toNV12(syntheticFrame(i, &square, true), nv12);
+        const std::map<int, cv::Rect> &tracked = multi.update(view);
+        for (int t = 0; t < 2; t++) {
+            cv::Rect roi = single[t]->update(view);
+            CHECK(tracked.at(t) == roi);
+        }
+    }
+
+    for (int t = 0; t < 2; t++)
+        delete single[t];
+    return testResult();
+}
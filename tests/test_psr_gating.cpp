@@ -0,0 +1,122 @@
+/*
+The adaptive mode: the peak-to-sidelobe ratio of a response, the stages gateStages() picks for
+a sequence of PSRs, and the stages update() reports on a synthetic sequence.
+*/
+
+#include <cmath>
+#include "kcftracker.hpp"
+#include "synthetic.hpp"
+#include "testing.hpp"
+
+class Probe : public KCFTracker
+{
+public:
+    Probe() : KCFTracker(true, true, true, false) {}
+
+    using KCFTracker::peakToSidelobe;
+    using KCFTracker::gateStages;
+};
+
+// (peak - mean) / stddev of the response outside the window of radius r around peak
+static float expectedPsr(const cv::Mat &res, const cv::Point &peak, int r)
+{
+    cv::Mat mask(res.size(), CV_8U, cv::Scalar(255));
+    cv::Rect window = cv::Rect(peak.x - r, peak.y - r, 2 * r + 1, 2 * r + 1) & cv::Rect(0, 0, res.cols, res.rows);
+    mask(window).setTo(0);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(res, mean, stddev, mask);
+    return (float) ((res.at<float>(peak) - mean[0]) / stddev[0]);
+}
+
+static void checkPsr(Probe &probe, const cv::Mat &res, const cv::Point &peak, int r)
+{
+    float psr = probe.peakToSidelobe(res, peak, res.at<float>(peak));
+    float expected = expectedPsr(res, peak, r);
+    CHECK(std::fabs(psr - expected) <= 1e-4f * std::fabs(expected));
+}
+
+// Runs gateStages for psr, and checks the stages it picks
+static void checkGate(Probe &probe, float psr, bool confident, bool search_scale)
+{
+    bool c, s;
+    probe.gateStages(psr, c, s);
+    CHECK(c == confident);
+    CHECK(s == search_scale);
+}
+
+int main()
+{
+    Probe probe;
+
+    // A peak over random sidelobes, in the middle and clipped by a corner; the window radius is a
+    // tenth of the smaller side
+    cv::Mat res(30, 20, CV_32F);
+    cv::RNG(4).fill(res, cv::RNG::UNIFORM, 0, 1);
+    res.at<float>(12, 9) = 5;
+    checkPsr(probe, res, cv::Point(9, 12), 2);
+    res.at<float>(0, 19) = 6;
+    checkPsr(probe, res, cv::Point(19, 0), 2);
+
+    // Flat sidelobes give no ratio
+    cv::Mat flat(10, 10, CV_32F, cv::Scalar(0.5));
+    flat.at<float>(5, 5) = 1;
+    CHECK(probe.peakToSidelobe(flat, cv::Point(5, 5), 1) == 0);
+
+    // Without the adaptive mode every stage runs
+    probe.adaptive = false;
+    for (int i = 0; i < 10; i++)
+        checkGate(probe, 0, true, true);
+
+    probe.adaptive = true;
+    probe.adaptive_min_psr = 7;
+    probe.adaptive_stable_psr = 20;
+    probe.adaptive_scale_interval = 5;
+
+    // Weak peaks update nothing, the others the models; the scale is searched on every frame
+    // until two strong ones follow each other
+    checkGate(probe, 6.9f, false, false);
+    checkGate(probe, 7, true, true);
+    checkGate(probe, 19.9f, true, true);
+    checkGate(probe, 30, true, true);
+
+    // Consecutive strong peaks search the scale every adaptive_scale_interval frames
+    for (int i = 1; i <= 12; i++)
+        checkGate(probe, 30, true, i % 5 == 0);
+
+    // A weaker peak ends the run, the next strong one searches again
+    checkGate(probe, 10, true, true);
+    checkGate(probe, 30, true, true);
+    checkGate(probe, 30, true, false);
+
+    // A weak one skips the scale search, and also ends the run
+    checkGate(probe, 5, false, false);
+    checkGate(probe, 30, true, true);
+    checkGate(probe, 30, true, false);
+
+    // On a tracked sequence, update() reports the PSR and the stages it ran
+    cv::Rect target;
+    cv::Mat frame = syntheticFrame(0, &target);
+    KCFTracker tracker(true, true, true, false);
+    tracker.init(target, frame);
+    for (int i = 1; i < 5; i++) {
+        tracker.update(syntheticFrame(i));
+        const KCFTracker::UpdateStages &stages = tracker.stages();
+        CHECK(stages.psr == 0 && stages.trained && stages.scale_detected && stages.scale_trained);
+        CHECK(stages.peak_value > 0);
+    }
+
+    tracker.adaptive = true;
+    tracker.adaptive_min_psr = 1e9f;
+    for (int i = 5; i < 10; i++) {
+        tracker.update(syntheticFrame(i));
+        const KCFTracker::UpdateStages &stages = tracker.stages();
+        CHECK(stages.psr > 0);
+        CHECK(!stages.trained && !stages.scale_detected && !stages.scale_trained);
+    }
+
+    tracker.adaptive_min_psr = 0;
+    tracker.update(syntheticFrame(10));
+    CHECK(tracker.stages().trained && tracker.stages().scale_detected);
+
+    return testResult();
+}
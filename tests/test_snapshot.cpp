@@ -0,0 +1,135 @@
+/*
+snapshot() and restore(): a restored tracker continues exactly like the one it was taken from,
+and restore() refuses blobs that are not snapshots of a tracker with the same features, leaving
+the tracker as it was.
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string.h>
+#include <type_traits>
+#include "kcftracker.hpp"
+#include "synthetic.hpp"
+#include "testing.hpp"
+
+// A copy would share and free the plan and the FHOG workspaces twice, snapshots are the way to copy a tracker
+static_assert(!std::is_copy_constructible<KCFTracker>::value && !std::is_copy_assignable<KCFTracker>::value,
+              "KCFTracker must not be copyable");
+
+// Offsets in the version 1 layout, see KCFTracker::snapshot()
+const size_t ROI_WIDTH_OFFSET = 115;
+const size_t UPDATES_OFFSET = 127;
+
+struct Configuration
+{
+    const char *name;
+    bool hog, lab, fast_scale, half_storage;
+};
+
+static void configure(KCFTracker &tracker, const Configuration &config)
+{
+    tracker.fast_scale = config.fast_scale;
+    if (config.fast_scale)
+        tracker.n_scales = 17;
+    tracker.half_storage = config.half_storage;
+}
+
+// The snapshots of two trackers in the same state, which differ in the number of updates
+static bool sameModel(std::vector<uchar> a, std::vector<uchar> b)
+{
+    if (a.size() != b.size() || a.size() < UPDATES_OFFSET + 4)
+        return false;
+    memset(&a[UPDATES_OFFSET], 0, 4);
+    memset(&b[UPDATES_OFFSET], 0, 4);
+    return a == b;
+}
+
+// Positions of the FFTW backend may differ by a rounding, its plans are measured at run time
+static bool samePosition(const cv::Rect &a, const cv::Rect &b)
+{
+#ifdef USE_FFTW
+    return std::abs(a.x - b.x) <= 1 && std::abs(a.y - b.y) <= 1 && std::abs(a.width - b.width) <= 1 && std::abs(a.height - b.height) <= 1;
+#else
+    return a == b;
+#endif
+}
+
+int main()
+{
+    const Configuration configurations[] = {
+        {"default", true, false, false, false},
+        {"gray", false, false, false, false},
+        {"lab", true, true, false, false},
+        {"fast scale", true, false, true, false},
+        {"half storage", true, false, false, true},
+    };
+
+    for (size_t c = 0; c < sizeof(configurations) / sizeof(configurations[0]); c++) {
+        const Configuration &config = configurations[c];
+        printf("%s\n", config.name);
+
+        KCFTracker original(config.hog, true, true, config.lab);
+        configure(original, config);
+        cv::Rect target;
+        cv::Mat first = syntheticFrame(0, &target, true);
+        original.init(target, first);
+        for (int i = 1; i <= 5; i++)
+            original.update(syntheticFrame(i, NULL, true));
+
+        std::vector<uchar> blob = original.snapshot();
+        KCFTracker restored(config.hog, true, true, config.lab);
+        configure(restored, config);
+        CHECK(restored.restore(blob));
+        CHECK(sameModel(restored.snapshot(), blob));
+
+        // Both go on alike
+        for (int i = 6; i < 16; i++) {
+            cv::Mat frame = syntheticFrame(i, NULL, true);
+            cv::Rect expected = original.update(frame);
+            CHECK(samePosition(restored.update(frame), expected));
+        }
+#ifndef USE_FFTW
+        CHECK(sameModel(restored.snapshot(), original.snapshot()));
+#endif
+    }
+
+    // Blobs restore() refuses
+    KCFTracker tracker(true, true, true, false);
+    cv::Rect target;
+    cv::Mat frame = syntheticFrame(0, &target);
+    tracker.init(target, frame);
+    tracker.update(syntheticFrame(1));
+    std::vector<uchar> blob = tracker.snapshot();
+
+    std::vector<uchar> truncated(blob.begin(), blob.end() - 1);
+    std::vector<uchar> longer(blob);
+    longer.push_back(0);
+    std::vector<uchar> magic(blob);
+    magic[0] ^= 1;
+    std::vector<uchar> nan_width(blob);
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    memcpy(&nan_width[ROI_WIDTH_OFFSET], &nan, 4);
+    std::vector<uchar> zero_width(blob);
+    memset(&zero_width[ROI_WIDTH_OFFSET], 0, 4);
+
+    KCFTracker other(true, true, true, false);
+    other.init(target, frame);
+    std::vector<uchar> before = other.snapshot();
+    CHECK(!other.restore(std::vector<uchar>()));
+    CHECK(!other.restore(truncated));
+    CHECK(!other.restore(longer));
+    CHECK(!other.restore(magic));
+    CHECK(!other.restore(nan_width));
+    CHECK(!other.restore(zero_width));
+    CHECK(other.snapshot() == before);
+    CHECK(other.restore(blob));
+
+    // The features must be those of the tracker
+    KCFTracker gray(false, true, true, false);
+    KCFTracker lab(true, true, true, true);
+    CHECK(!gray.restore(blob));
+    CHECK(!lab.restore(blob));
+
+    return testResult();
+}
@@ -0,0 +1,63 @@
+/*
+SpscQueue: capacity, order and wrap-around on one thread, the release of popped items, and
+the order of the items passed between a producer and a consumer thread.
+*/
+
+#include <memory>
+#include <thread>
+#include "spscqueue.hpp"
+#include "testing.hpp"
+
+int main()
+{
+    // Full and empty queue
+    SpscQueue<int> queue(3);
+    int item = -1;
+    CHECK(!queue.tryPop(item) && item == -1);
+    CHECK(queue.tryPush(1) && queue.tryPush(2) && queue.tryPush(3));
+    CHECK(!queue.tryPush(4));
+    CHECK(queue.tryPop(item) && item == 1);
+    CHECK(queue.tryPush(4));
+    CHECK(!queue.tryPush(5));
+
+    // Order over several turns of the ring
+    int expected = 2;
+    for (int next = 5; next < 50; next++) {
+        CHECK(queue.tryPop(item) && item == expected);
+        expected++;
+        CHECK(queue.tryPush(next));
+    }
+    while (queue.tryPop(item)) {
+        CHECK(item == expected);
+        expected++;
+    }
+    CHECK(expected == 50);
+
+    // A popped item is not kept alive by its slot
+    SpscQueue<std::shared_ptr<int> > shared(2);
+    std::shared_ptr<int> value(new int(7)), popped;
+    shared.push(value);
+    CHECK(value.use_count() == 2);
+    shared.pop(popped);
+    CHECK(*popped == 7 && value.use_count() == 2);
+    popped.reset();
+    CHECK(value.use_count() == 1);
+
+    // Items pass between two threads in order, through a queue that is mostly full or empty
+    const int count = 200000;
+    SpscQueue<int> pipe(4);
+    std::thread producer([&pipe, count] {
+        for (int i = 0; i < count; i++)
+            pipe.push(i);
+    });
+    int out_of_order = 0;
+    for (int i = 0; i < count; i++) {
+        pipe.pop(item);
+        out_of_order += item != i;
+    }
+    producer.join();
+    CHECK(out_of_order == 0);
+    CHECK(!pipe.tryPop(item));
+
+    return testResult();
+}
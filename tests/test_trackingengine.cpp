@@ -0,0 +1,82 @@
+/*
+TrackingEngine: an exception of a tracker or of the callback does not escape the pool worker. The
+frame still finishes, the other targets are tracked, and the first exception is rethrown once by
+waitIdle().
+*/
+
+#include <atomic>
+#include <stdexcept>
+#include "kcftracker.hpp"
+#include "trackingengine.hpp"
+#include "synthetic.hpp"
+#include "testing.hpp"
+
+// Throws on its third update
+class FailingTracker : public KCFTracker
+{
+public:
+    FailingTracker() : _calls(0) {}
+
+    virtual cv::Rect update(const ImagePyramid &pyramid)
+    {
+        if (++_calls == 3)
+            throw std::runtime_error("update failed");
+        return KCFTracker::update(pyramid);
+    }
+
+private:
+    int _calls;
+};
+
+static bool waitIdleThrows(TrackingEngine &engine)
+{
+    try {
+        engine.waitIdle();
+    }
+    catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    std::atomic<int> failing(0);
+    TrackingEngine engine(2, [&failing]() -> KCFTracker * {
+        if (failing++ == 0)
+            return new FailingTracker();
+        return new KCFTracker(true, true, true, false);
+    });
+
+    std::atomic<int> callbacks(0), tracked(0);
+    engine.setCallback([&callbacks, &tracked](int, int64, const std::map<int, cv::Rect> &rois) {
+        callbacks++;
+        tracked += (int) rois.size();
+    });
+
+    // The square, and a second target on the background
+    int stream = engine.addStream();
+    cv::Rect square;
+    std::vector<cv::Mat> frames;
+    for (int i = 0; i < 6; i++)
+        frames.push_back(syntheticFrame(i, i == 0 ? &square : NULL));
+    engine.addTarget(stream, 0, square);
+    engine.addTarget(stream, 1, cv::Rect(200, 140, 40, 56));
+
+    for (int i = 0; i < 6; i++)
+        engine.submit(stream, frames[i], i);
+    CHECK(waitIdleThrows(engine));
+    CHECK(!waitIdleThrows(engine));
+    CHECK(callbacks == 6);
+    CHECK(tracked == 12);
+    CHECK(engine.stats(stream).tracked == 6);
+
+    // A callback that throws is reported the same way, and the next frames go on
+    engine.setCallback([](int, int64, const std::map<int, cv::Rect> &) { throw std::runtime_error("callback failed"); });
+    engine.submit(stream, frames[5], 6);
+    engine.submit(stream, frames[5], 7);
+    CHECK(waitIdleThrows(engine));
+    CHECK(engine.stats(stream).tracked == 8);
+
+    return testResult();
+}
@@ -0,0 +1,132 @@
+/*
+WorkStealingPool: parallelFor covers its range once, also when called from inside a stripe,
+rethrows the exception of a stripe, and finishes while every worker is busy without running
+other tasks on its caller. An exception of a submitted task is kept for takeError() and does not
+stop its worker. Submitted tasks all run before the pool is destroyed.
+*/
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "workstealingpool.hpp"
+#include "testing.hpp"
+
+// Counts the indices it is run for, throws at index fail, and runs a nested loop per index with nested
+class CountBody : public cv::ParallelLoopBody
+{
+public:
+    CountBody(std::vector<std::atomic<int> > &hits, WorkStealingPool *nested = NULL, int fail = -1)
+        : _hits(hits), _nested(nested), _fail(fail) {}
+
+    virtual void operator()(const cv::Range &range) const
+    {
+        for (int i = range.start; i < range.end; i++) {
+            if (i == _fail)
+                throw std::runtime_error("stripe failed");
+            _hits[i]++;
+            if (_nested) {
+                std::vector<std::atomic<int> > hits(16);
+                _nested->parallelFor(cv::Range(0, 16), CountBody(hits), 4);
+                for (size_t j = 0; j < hits.size(); j++)
+                    CHECK(hits[j] == 1);
+            }
+        }
+    }
+
+private:
+    std::vector<std::atomic<int> > &_hits;
+    WorkStealingPool *_nested;
+    int _fail;
+};
+
+static bool coveredOnce(const std::vector<std::atomic<int> > &hits)
+{
+    for (size_t i = 0; i < hits.size(); i++)
+        if (hits[i] != 1)
+            return false;
+    return true;
+}
+
+int main()
+{
+    WorkStealingPool pool(4);
+    CHECK(pool.threads() == 4);
+
+    for (int round = 0; round < 100; round++) {
+        std::vector<std::atomic<int> > hits(100);
+        pool.parallelFor(cv::Range(0, 100), CountBody(hits, round % 2 ? &pool : NULL), 8);
+        CHECK(coveredOnce(hits));
+
+        // The exception of a stripe reaches the caller, after the other stripes are done
+        std::vector<std::atomic<int> > partial(100);
+        bool caught = false;
+        try {
+            pool.parallelFor(cv::Range(0, 100), CountBody(partial, NULL, round), 8);
+        }
+        catch (const std::runtime_error &) {
+            caught = true;
+        }
+        CHECK(caught);
+    }
+
+    // With the only worker blocked, the caller runs all stripes itself, and not the queued task
+    {
+        WorkStealingPool single(1);
+        std::atomic<bool> release(false);
+        std::atomic<int> other(0);
+        std::thread::id other_thread;
+        single.submit([&release] {
+            while (!release)
+                std::this_thread::yield();
+        });
+        single.submit([&other, &other_thread] {
+            other_thread = std::this_thread::get_id();
+            other++;
+        });
+        std::vector<std::atomic<int> > hits(50);
+        single.parallelFor(cv::Range(0, 50), CountBody(hits), 5);
+        CHECK(coveredOnce(hits));
+        CHECK(other == 0);
+        release = true;
+        while (other == 0)
+            std::this_thread::yield();
+        CHECK(other_thread != std::this_thread::get_id());
+    }
+
+    // An exception of a task is kept, and the worker goes on with the other tasks
+    {
+        WorkStealingPool single(1);
+        std::atomic<int> after(0);
+        CHECK(!single.takeError());
+        single.submit([] { throw std::runtime_error("task failed"); });
+        for (int i = 0; i < 100; i++)
+            single.submit([&after] { after++; });
+        std::exception_ptr error;
+        while (!error || after < 100) {
+            std::this_thread::yield();
+            if (!error)
+                error = single.takeError();
+        }
+        bool caught = false;
+        try {
+            std::rethrow_exception(error);
+        }
+        catch (const std::runtime_error &) {
+            caught = true;
+        }
+        CHECK(caught);
+        CHECK(!single.takeError());
+    }
+
+    // The destructor runs what is still queued
+    std::atomic<int> done(0);
+    {
+        WorkStealingPool small(2);
+        for (int i = 0; i < 1000; i++)
+            small.submit([&done] { done++; });
+    }
+    CHECK(done == 1000);
+
+    return testResult();
+}
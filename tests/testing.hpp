@@ -0,0 +1,30 @@
+/*
+Checks of the unit tests in this directory. CHECK reports a failed condition with its location
+and lets the test go on, unlike assert it is kept in release builds. main() returns testResult().
+*/
+
+#pragma once
+
+#include <stdio.h>
+
+inline int &testFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            testFailures()++; \
+        } \
+    } while (0)
+
+// Exit code of a test: 0 when every check passed
+inline int testResult()
+{
+    if (testFailures())
+        fprintf(stderr, "%d checks failed\n", testFailures());
+    return testFailures() ? 1 : 0;
+}